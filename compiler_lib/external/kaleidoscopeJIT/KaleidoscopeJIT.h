@@ -17,6 +17,7 @@
 #include "llvm/ADT/iterator_range.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
@@ -37,45 +38,175 @@
 namespace llvm {
 namespace orc {
 
+/// Section memory manager keeping count of the bytes allocated for code and
+/// data sections.
+class CountingMemoryManager : public SectionMemoryManager {
+public:
+  struct Usage {
+    size_t CodeBytes = 0;
+    size_t DataBytes = 0;
+  };
+
+  explicit CountingMemoryManager(std::shared_ptr<Usage> Counters)
+      : Counters(std::move(Counters)) {}
+
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID,
+                               StringRef SectionName) override {
+    Counters->CodeBytes += Size;
+    return SectionMemoryManager::allocateCodeSection(Size, Alignment,
+                                                     SectionID, SectionName);
+  }
+
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID, StringRef SectionName,
+                               bool IsReadOnly) override {
+    Counters->DataBytes += Size;
+    return SectionMemoryManager::allocateDataSection(
+        Size, Alignment, SectionID, SectionName, IsReadOnly);
+  }
+
+private:
+  std::shared_ptr<Usage> Counters;
+};
+
+/// Object cache keeping a copy of the last object compiled, when enabled.
+/// Never provides objects: every module is compiled.
+class ObjectRecorder : public ObjectCache {
+public:
+  void notifyObjectCompiled(const Module *, MemoryBufferRef Obj) override {
+    if (Enabled)
+      Last = MemoryBuffer::getMemBufferCopy(Obj.getBuffer(),
+                                            Obj.getBufferIdentifier());
+  }
+
+  std::unique_ptr<MemoryBuffer> getObject(const Module *) override {
+    return nullptr;
+  }
+
+  bool Enabled = false;
+  std::unique_ptr<MemoryBuffer> Last;
+};
+
 class KaleidoscopeJIT {
 public:
   using ObjLayerT = LegacyRTDyldObjectLinkingLayer;
   using CompileLayerT = LegacyIRCompileLayer<ObjLayerT, SimpleCompiler>;
 
+  /// Key of a layer of modules. Layer 0 is the root layer.
+  using LayerKey = unsigned;
+
   KaleidoscopeJIT()
-      : Resolver(createLegacyLookupResolver(
-            ES,
-            [this](StringRef Name) {
-              return findMangledSymbol(std::string(Name));
-            },
-            [](Error Err) { cantFail(std::move(Err), "lookupFlags failed"); })),
-        TM(EngineBuilder().selectTarget()), DL(TM->createDataLayout()),
+      : TM(EngineBuilder().selectTarget()), DL(TM->createDataLayout()),
         ObjectLayer(AcknowledgeORCv1Deprecation, ES,
-                    [this](VModuleKey) {
+                    [this](VModuleKey K) {
+                      // Symbols of a module resolve within its layer.
+                      LayerKey L = ModuleLayers[K];
                       return ObjLayerT::Resources{
-                          std::make_shared<SectionMemoryManager>(), Resolver};
+                          std::make_shared<CountingMemoryManager>(MemoryUsage),
+                          createLegacyLookupResolver(
+                              ES,
+                              [this, L](StringRef Name) {
+                                return findMangledSymbol(std::string(Name), L);
+                              },
+                              [](Error Err) {
+                                cantFail(std::move(Err), "lookupFlags failed");
+                              })};
                     }),
         CompileLayer(AcknowledgeORCv1Deprecation, ObjectLayer,
-                     SimpleCompiler(*TM)) {
+                     SimpleCompiler(*TM, &Recorder)) {
     llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
   }
 
   TargetMachine &getTargetMachine() { return *TM; }
 
-  VModuleKey addModule(std::unique_ptr<Module> M) {
+  /// Bytes allocated for the sections of every object added to the JIT.
+  const CountingMemoryManager::Usage &getMemoryUsage() const {
+    return *MemoryUsage;
+  }
+
+  /// Create a layer over Base. Symbols are searched in the layer first, then
+  /// in the layers below it, so a layer can redefine the symbols of its base
+  /// without the base or the other layers seeing it.
+  LayerKey createLayer(LayerKey Base) {
+    auto L = NextLayer++;
+    Layers[L].Base = Base;
+    return L;
+  }
+
+  /// Remove a layer and all its modules. The layers created over it must be
+  /// removed first.
+  void removeLayer(LayerKey L) {
+    auto Keys = Layers[L].Keys;
+    for (auto K : Keys)
+      removeModule(K);
+    Layers.erase(L);
+  }
+
+  VModuleKey addModule(std::unique_ptr<Module> M, LayerKey L = 0) {
     auto K = ES.allocateVModule();
+    ModuleLayers[K] = L;
     cantFail(CompileLayer.addModule(K, std::move(M)));
-    ModuleKeys.push_back(K);
+    Layers[L].Keys.push_back(K);
+    if (Recorder.Last)
+      RecordedObjects.emplace_back(K, std::move(Recorder.Last));
+    return K;
+  }
+
+  /// Add an object compiled by another JIT for the same target.
+  VModuleKey addObject(std::unique_ptr<MemoryBuffer> Obj, LayerKey L = 0) {
+    auto K = ES.allocateVModule();
+    ModuleLayers[K] = L;
+    if (Recorder.Enabled)
+      RecordedObjects.emplace_back(
+          K, MemoryBuffer::getMemBufferCopy(Obj->getBuffer(),
+                                            Obj->getBufferIdentifier()));
+    cantFail(ObjectLayer.addObject(K, std::move(Obj)));
+    Layers[L].Keys.push_back(K);
     return K;
   }
 
   void removeModule(VModuleKey K) {
-    ModuleKeys.erase(find(ModuleKeys, K));
+    auto &Keys = Layers[ModuleLayers[K]].Keys;
+    Keys.erase(find(Keys, K));
+    ModuleLayers.erase(K);
+    llvm::erase_if(RecordedObjects,
+                   [K](const std::pair<VModuleKey, std::unique_ptr<MemoryBuffer>>
+                           &Recorded) { return Recorded.first == K; });
     cantFail(CompileLayer.removeModule(K));
   }
 
-  JITSymbol findSymbol(const std::string Name) {
-    return findMangledSymbol(mangle(Name));
+  /// Keep a copy of every object added from now on, until its module is
+  /// removed.
+  void setObjectRecording(bool Enabled) { Recorder.Enabled = Enabled; }
+
+  /// Objects recorded for layer L and the layers below it, from the root
+  /// layer up and in the order they were added within a layer: loaded in this
+  /// order in a single layer, they resolve symbols the way layer L does.
+  std::vector<MemoryBufferRef> getRecordedObjects(LayerKey L = 0) const {
+    std::vector<LayerKey> Chain;
+    for (auto Layer = L;; Layer = Layers.at(Layer).Base) {
+      Chain.push_back(Layer);
+      if (Layer == 0)
+        break;
+    }
+    std::vector<MemoryBufferRef> Objects;
+    for (auto Layer : make_range(Chain.rbegin(), Chain.rend()))
+      for (const auto &Recorded : RecordedObjects)
+        if (ModuleLayers.at(Recorded.first) == Layer)
+          Objects.push_back(Recorded.second->getMemBufferRef());
+    return Objects;
+  }
+
+  /// Search the symbols of Lib for layer L and the layers over it, after the
+  /// modules of L and before the host process. Lib must stay loaded as long
+  /// as the layer.
+  void addLibrary(sys::DynamicLibrary Lib, LayerKey L = 0) {
+    Layers[L].Libraries.push_back(Lib);
+  }
+
+  JITSymbol findSymbol(const std::string Name, LayerKey L = 0) {
+    return findMangledSymbol(mangle(Name), L);
   }
 
 private:
@@ -88,7 +219,7 @@ private:
     return MangledName;
   }
 
-  JITSymbol findMangledSymbol(const std::string &Name) {
+  JITSymbol findMangledSymbol(const std::string &Name, LayerKey L) {
 #ifdef _WIN32
     // The symbol lookup of ObjectLinkingLayer uses the SymbolRef::SF_Exported
     // flag to decide whether a symbol will be visible or not, when we call
@@ -102,12 +233,23 @@ private:
     const bool ExportedSymbolsOnly = true;
 #endif
 
-    // Search modules in reverse order: from last added to first added.
+    // Search the layers from L down to the root layer, and the modules then
+    // the libraries of a layer in reverse order: from last added to first
+    // added.
     // This is the opposite of the usual search order for dlsym, but makes more
     // sense in a REPL where we want to bind to the newest available definition.
-    for (auto H : make_range(ModuleKeys.rbegin(), ModuleKeys.rend()))
-      if (auto Sym = CompileLayer.findSymbolIn(H, Name, ExportedSymbolsOnly))
-        return Sym;
+    for (auto Layer = L;; Layer = Layers[Layer].Base) {
+      const auto &Keys = Layers[Layer].Keys;
+      for (auto H : make_range(Keys.rbegin(), Keys.rend()))
+        if (auto Sym = CompileLayer.findSymbolIn(H, Name, ExportedSymbolsOnly))
+          return Sym;
+      for (auto Lib : make_range(Layers[Layer].Libraries.rbegin(),
+                                 Layers[Layer].Libraries.rend()))
+        if (auto SymAddr = findSymbolInLibrary(Lib, Name))
+          return JITSymbol(SymAddr, JITSymbolFlags::Exported);
+      if (Layer == 0)
+        break;
+    }
 
     // If we can't find the symbol in the JIT, try looking in the host process.
     if (auto SymAddr = RTDyldMemoryManager::getSymbolAddressInProcess(Name))
@@ -126,13 +268,36 @@ private:
     return nullptr;
   }
 
+  static JITTargetAddress findSymbolInLibrary(sys::DynamicLibrary Lib,
+                                              const std::string &Name) {
+    const char *NameStr = Name.c_str();
+#ifdef __APPLE__
+    // dlsym adds the global prefix of the mangled name.
+    if (*NameStr == '_')
+      ++NameStr;
+#endif
+    return pointerToJITTargetAddress(Lib.getAddressOfSymbol(NameStr));
+  }
+
+  std::shared_ptr<CountingMemoryManager::Usage> MemoryUsage =
+      std::make_shared<CountingMemoryManager::Usage>();
+  ObjectRecorder Recorder;
+  std::vector<std::pair<VModuleKey, std::unique_ptr<MemoryBuffer>>>
+      RecordedObjects;
   ExecutionSession ES;
-  std::shared_ptr<SymbolResolver> Resolver;
   std::unique_ptr<TargetMachine> TM;
   const DataLayout DL;
   ObjLayerT ObjectLayer;
   CompileLayerT CompileLayer;
-  std::vector<VModuleKey> ModuleKeys;
+
+  struct LayerInfo {
+    LayerKey Base = 0;
+    std::vector<VModuleKey> Keys;
+    std::vector<sys::DynamicLibrary> Libraries;
+  };
+  std::map<LayerKey, LayerInfo> Layers;
+  std::map<VModuleKey, LayerKey> ModuleLayers;
+  LayerKey NextLayer = 1;
 };
 
 } // end namespace orc
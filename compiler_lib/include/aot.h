@@ -0,0 +1,38 @@
+//
+// Ahead of time compilation: target selection and linking of the emitted objects
+//
+
+#ifndef LLVM_KALEIDOSCOPE_AOT_H
+#define LLVM_KALEIDOSCOPE_AOT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/Target/TargetMachine.h"
+
+namespace ckalei {
+
+    /// Highest optimisation level of an ahead of time compilation
+    const unsigned MAX_OPT_LEVEL = 3;
+
+    /// Options of an ahead of time compilation
+    struct AotOptions{
+        unsigned optLevel = 2; // 0 to MAX_OPT_LEVEL, 0 disables the optimisation passes
+        std::string cpu = "generic"; // target cpu, "native" for the host cpu and its features
+        bool emitMain = false; // emit a main printing the top level expressions, for executables
+        std::vector<std::string> libraries; // shared libraries linked to the output, by absolute path
+    };
+
+    /// Return a target machine for the host triple emitting position independent code, nullptr on error or if the
+    /// optimisation level is above MAX_OPT_LEVEL
+    std::unique_ptr<llvm::TargetMachine> createAotTargetMachine(const AotOptions& options);
+
+    /// Link objects into a shared library with the system compiler driver. Return false on error
+    bool linkSharedLibrary(const std::vector<std::string>& objects, const std::string& output);
+
+    /// Link objects with the Kaleidoscope runtime into an executable. Return false on error
+    bool linkExecutable(const std::vector<std::string>& objects, const std::string& output);
+}
+
+#endif //LLVM_KALEIDOSCOPE_AOT_H
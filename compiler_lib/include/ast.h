@@ -5,11 +5,13 @@
 #ifndef LLVM_KALEIDOSCOPE_AST_H
 #define LLVM_KALEIDOSCOPE_AST_H
 
+#include <cstdint>
 #include <string>
 #include <utility>
 #include <memory>
 #include <vector>
 
+#include "lexer.h"
 #include "visitor.h"
 
 
@@ -17,11 +19,32 @@ namespace ckalei {
 
     class Visitor;
 
+    /// Types of the values. A value is a f64 unless annotated otherwise: name:i64
+    enum ValueType: uint8_t{
+        type_f64,
+        type_i64,
+        type_f32,
+        type_last = type_f32,
+    };
+    /// Return the name of type in the source
+    std::string typeName(ValueType type);
+    /// Set type to the type called name. Return false if no type has this name
+    bool typeFromName(const std::string& name, ValueType& type);
+    /// Set type to the type the function callee converts to: toi64, tof32 or tof64. Return false if callee is not a
+    /// conversion
+    bool conversionFromName(const std::string& callee, ValueType& type);
+
     /// Base class for ast nodes
     class ASTNode{
     public:
         virtual void accept(Visitor& visitor) = 0;
         virtual ~ASTNode() = default;
+
+        /// Counting allocation of ast nodes
+        static void* operator new(std::size_t size);
+        static void operator delete(void* ptr, std::size_t size);
+        /// Return the bytes of ast nodes currently allocated by the calling thread
+        static std::size_t allocatedBytes();
     };
 
     /// Base class for all expression node
@@ -75,34 +98,54 @@ namespace ckalei {
     public:
         BinaryExprAST(std::unique_ptr<ExprAST> leftExpr,
                       std::unique_ptr<ExprAST> rightExpr,
-                      char op) : rightExpr(std::move(rightExpr)), leftExpr(std::move(leftExpr)), op(op)
+                      int op) : rightExpr(std::move(rightExpr)), leftExpr(std::move(leftExpr)), op(op)
         {};
         void accept(Visitor& visitor) override;
 
-        [[nodiscard]] char getOp() const {return op;}
+        /// Return the operator, a character or an OperatorCode
+        [[nodiscard]] int getOp() const {return op;}
         [[nodiscard]] const std::unique_ptr<ExprAST> &getRightExpr() const {return rightExpr;}
         [[nodiscard]] const std::unique_ptr<ExprAST> &getLeftExpr() const {return leftExpr;}
 
     private:
-        char op; // operation of the expression
+        int op; // operation of the expression
         std::unique_ptr<ExprAST>leftExpr, rightExpr;
     };
 
+    /// Return true if op is a built in binary operator, compiled without calling a definition
+    bool isBuiltinBinaryOp(int op);
+    /// Return true if op is a built in comparison or logic operator, whose value is a boolean
+    bool isBooleanBinaryOp(int op);
+    /// Return true if op can name a user defined operator
+    bool isOperatorChar(char op);
+    /// Return true if name is a valid identifier for the lexer
+    bool isIdentifier(const std::string& name);
+
     /// Node representing variables creation: var a=1, b, c, d=2
     class DeclarationExprAST: public  ExprAST{
     public:
+        /// types holds the type of each variable, all f64 if empty
         explicit DeclarationExprAST(std::unique_ptr<ExprAST> body,
-                                    std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> vars)
-                                    : vars(std::move(vars)), body(std::move(body))
-                                    {}
+                                    std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> vars,
+                                    std::vector<ValueType> types = {})
+                                    : vars(std::move(vars)), types(std::move(types)), body(std::move(body))
+                                    {
+                                        if (!this->types.empty()){
+                                            this->types.resize(this->vars.size(), type_f64);
+                                        }
+                                    }
         void accept(Visitor& visitor) override;
 
         [[nodiscard]] const std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> &getVars() const {return vars;}
+        /// Return the types of the variables, empty if all are f64
+        [[nodiscard]] const std::vector<ValueType> &getTypes() const {return types;}
+        [[nodiscard]] ValueType getType(std::size_t i) const {return types.empty() ? type_f64 : types[i];}
         [[nodiscard]] const std::unique_ptr<ExprAST> &getBody() const{return body;}
 
     private:
         // List of allocation, pairs name: values
         std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> vars;
+        std::vector<ValueType> types; // empty when all are f64, untyped code allocates nothing more
         // Body where variable are valid
         std::unique_ptr<ExprAST> body;
     };
@@ -169,17 +212,20 @@ namespace ckalei {
                 std::unique_ptr<ExprAST> step,
                 std::unique_ptr<ExprAST> end,
                 std::unique_ptr<ExprAST> body,
-                std::string varName
+                std::string varName,
+                ValueType varType = type_f64
                 )
                 : start(std::move(start)),
                 step(std::move(step)),
                 end(std::move(end)),
                 body(std::move(body)),
-                varName(std::move(varName)){};
+                varName(std::move(varName)),
+                varType(varType){};
 
         void accept(Visitor& visitor) override;
 
         [[nodiscard]] const std::string &getVarName() const{return varName;}
+        [[nodiscard]] ValueType getVarType() const{return varType;}
         [[nodiscard]] const std::unique_ptr<ExprAST> &getStart() const{return start;}
         [[nodiscard]] const std::unique_ptr<ExprAST> &getStep() const{return step;}
         [[nodiscard]] const std::unique_ptr<ExprAST> &getEnd() const{return end;}
@@ -187,6 +233,7 @@ namespace ckalei {
 
     private:
         std::string varName;
+        ValueType varType;
         std::unique_ptr<ExprAST> start;
         std::unique_ptr<ExprAST> step;
         std::unique_ptr<ExprAST> end;
@@ -196,29 +243,45 @@ namespace ckalei {
     /// Node representing a function prototype
     class PrototypeAST: public ASTNode{
     public:
+        /// argTypes holds the type of each argument, all f64 if empty
         PrototypeAST(std::string name,
                      std::vector<std::string> args,
                      bool isOperator = false,
-                     int precedence = 0):
+                     int precedence = 0,
+                     std::vector<ValueType> argTypes = {},
+                     ValueType returnType = type_f64):
                         name(std::move(name)),
                         args(std::move(args)),
+                        argTypes(std::move(argTypes)),
+                        returnType(returnType),
                         isOperator(isOperator),
-                        precedence(precedence){};
+                        precedence(precedence)
+        {
+            if (!this->argTypes.empty()){
+                this->argTypes.resize(this->args.size(), type_f64);
+            }
+        };
         PrototypeAST(const PrototypeAST& other):
                 name(other.getName()),
                 args(other.getArgs()),
+                argTypes(other.argTypes),
+                returnType(other.getReturnType()),
                 isOperator(other.isOperatorProto()),
                 precedence(other.getPrecedence())  {};
 
         void accept(Visitor& visitor) override;
         [[nodiscard]] const std::string &getName() const {return name;}
         [[nodiscard]] const std::vector<std::string> &getArgs() const {return args;}
+        [[nodiscard]] ValueType getArgType(std::size_t i) const {return argTypes.empty() ? type_f64 : argTypes[i];}
+        [[nodiscard]] ValueType getReturnType() const {return returnType;}
         [[nodiscard]] bool isOperatorProto() const{return isOperator;}
         [[nodiscard]] int getPrecedence() const{return precedence;}
 
     private:
         std::string name;
         std::vector<std::string> args;
+        std::vector<ValueType> argTypes; // empty when all are f64
+        ValueType returnType;
         bool isOperator;
         int precedence; // precedence if a binary op.
     };
@@ -0,0 +1,89 @@
+//
+// Builder of programs from C++, for code generators: the ast is built directly instead of printing Kaleidoscope
+// text for the lexer and the parser.
+//
+
+#ifndef LLVM_KALEIDOSCOPE_BUILDER_H
+#define LLVM_KALEIDOSCOPE_BUILDER_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "program.h"
+
+namespace ckalei {
+
+    /// Build the nodes of a program with the checks of the parser and the code generation: names, operators,
+    /// variable scopes, call arities and types. Invalid constructs are logged and rejected: expression methods return
+    /// nullptr, which the enclosing calls propagate, and top level methods return false.
+    class ASTBuilder{
+
+    public:
+        // Expressions
+        std::unique_ptr<ExprAST> number(double val);
+        std::unique_ptr<ExprAST> variable(const std::string& name);
+        /// Apply a user defined unary operator
+        std::unique_ptr<ExprAST> unary(char op, std::unique_ptr<ExprAST> expr);
+        /// Apply a built in or user defined binary operator, a character or an OperatorCode. Use assign for '='
+        std::unique_ptr<ExprAST> binary(int op, std::unique_ptr<ExprAST> lhs, std::unique_ptr<ExprAST> rhs);
+        /// name = value
+        std::unique_ptr<ExprAST> assign(const std::string& name, std::unique_ptr<ExprAST> value);
+        std::unique_ptr<ExprAST> call(const std::string& callee, std::vector<std::unique_ptr<ExprAST>> args = {});
+        template<typename... Args>
+        std::unique_ptr<ExprAST> call(const std::string& callee, std::unique_ptr<ExprAST> arg, Args... args)
+        {
+            std::vector<std::unique_ptr<ExprAST>> argsVector;
+            argsVector.push_back(std::move(arg));
+            (argsVector.push_back(std::move(args)), ...);
+            return call(callee, std::move(argsVector));
+        }
+        /// if cond then ifExpr else elseExpr
+        std::unique_ptr<ExprAST> ifThenElse(std::unique_ptr<ExprAST> cond, std::unique_ptr<ExprAST> ifExpr,
+                                            std::unique_ptr<ExprAST> elseExpr);
+        /// for varName:varType = start, end, step in body
+        std::unique_ptr<ExprAST> forLoop(const std::string& varName, std::unique_ptr<ExprAST> start,
+                                         std::unique_ptr<ExprAST> end, std::unique_ptr<ExprAST> step,
+                                         std::unique_ptr<ExprAST> body, ValueType varType = type_f64);
+        /// var name:type = value, ... in body. Values may be null, variables are then initialised to 0. types holds
+        /// the type of each variable, all f64 if empty
+        std::unique_ptr<ExprAST> declaration(std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> vars,
+                                             std::unique_ptr<ExprAST> body, std::vector<ValueType> types = {});
+
+        // Top level nodes, checked against the functions and operators added before them. argTypes holds the type of
+        // each argument, all f64 if empty
+        bool addExtern(const std::string& name, std::vector<std::string> args, std::vector<ValueType> argTypes = {},
+                       ValueType returnType = type_f64);
+        bool addFunction(const std::string& name, std::vector<std::string> args, std::unique_ptr<ExprAST> body,
+                         std::vector<ValueType> argTypes = {}, ValueType returnType = type_f64);
+        bool addBinaryOperator(char op, int precedence, const std::string& lhs, const std::string& rhs,
+                               std::unique_ptr<ExprAST> body, std::vector<ValueType> argTypes = {},
+                               ValueType returnType = type_f64);
+        bool addUnaryOperator(char op, const std::string& arg, std::unique_ptr<ExprAST> body,
+                              std::vector<ValueType> argTypes = {}, ValueType returnType = type_f64);
+        /// Add a top level expression, evaluated by the program
+        bool addExpression(std::unique_ptr<ExprAST> body);
+
+        /// Return the number of constructs rejected so far
+        [[nodiscard]] int getErrorCount() const {return errors;}
+        /// Hand the nodes built so far to a new program and reset the builder. Return nullptr if any construct was
+        /// rejected
+        std::unique_ptr<Program> build();
+
+    private:
+        /// Check and add a top level node defining or declaring a prototype
+        bool addNode(const std::string& name, std::vector<std::string> args, std::vector<ValueType> argTypes,
+                     ValueType returnType, std::unique_ptr<ExprAST> body, bool isOperator = false,
+                     int precedence = 0);
+        /// Log an error and count it
+        std::nullptr_t logError(const std::string& str);
+
+        std::vector<std::unique_ptr<ASTNode>> nodes;
+        std::map<std::string, PrototypeAST> prototypes; // signature of the known functions and operators
+        int errors = 0;
+    };
+}
+
+#endif //LLVM_KALEIDOSCOPE_BUILDER_H
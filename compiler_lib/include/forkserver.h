@@ -0,0 +1,46 @@
+//
+// Fork server: a prewarmed session forking workers on demand
+//
+
+#ifndef LLVM_KALEIDOSCOPE_FORKSERVER_H
+#define LLVM_KALEIDOSCOPE_FORKSERVER_H
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <sys/types.h>
+
+#include "session.h"
+
+namespace ckalei {
+
+    /// A fork server initialises LLVM and a session with its prelude once, then forks workers which inherit the warm
+    /// session copy on write: a worker starts without initialising targets, creating a jit or compiling the prelude.
+    /// What a worker evaluates is private to it.
+    ///
+    /// Only the calling thread survives a fork, so the server refuses to fork while the process runs other threads:
+    /// their locks and state would be left inconsistent in the worker.
+    class ForkServer{
+
+    public:
+        /// Prewarm a server evaluating prelude, which should only hold definitions
+        explicit ForkServer(const std::string& prelude);
+        /// Prewarm a server from a session, for instance restored from a snapshot
+        explicit ForkServer(std::unique_ptr<Session> session);
+
+        /// Fork a worker running work on its copy of the session, and exiting with the code work returns. Return the
+        /// pid of the worker, or -1 on error
+        pid_t spawn(const std::function<int(Session&)>& work);
+        /// Wait for the end of a worker. Return its exit code, or -1 if it did not exit normally
+        static int wait(pid_t pid);
+
+        /// Return the session of the server, inherited by the workers forked after any change to it
+        Session &getSession() {return *session;}
+
+    private:
+        std::unique_ptr<Session> session;
+    };
+}
+
+#endif //LLVM_KALEIDOSCOPE_FORKSERVER_H
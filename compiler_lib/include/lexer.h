@@ -43,20 +43,37 @@ namespace ckalei{
         tok_other,
     };
 
+    /// Operators spelled with two characters, all built in. getOtherChar returns them after the values of the single
+    /// characters
+    enum OperatorCode{
+        op_le = 256, // <=
+        op_ge,       // >=
+        op_eq,       // ==
+        op_ne,       // !=
+        op_and,      // &&
+        op_or,       // ||
+        op_last = op_or,
+    };
+    /// Return the source text of an operator, a character or an OperatorCode
+    std::string operatorSpelling(int op);
+
     // Simple lexer class
     class Lexer{
     public:
         explicit Lexer(std::string inputText): inputText(std::move(inputText)), lastChar(' '){
             iteText = this->inputText.begin();
+            identifierStr.reserve(64); // common identifiers are lexed without growing the buffer
         };
         Lexer(const Lexer&) = delete;  // disable copy constructor because it do not copy iterator state
 
         // return the next token from standard input
         Token getTok();
 
-        std::string getIdentifier(){return identifierStr;}
+        [[nodiscard]] const std::string &getIdentifier() const{return identifierStr;}
         [[nodiscard]] double getNumVal() const{return numVal;}
         [[nodiscard]] int getOtherChar() const{return otherChar;}
+        /// Return the bytes held by the lexer copy of the source text
+        [[nodiscard]] std::size_t getSourceBytes() const{return inputText.capacity();}
 
     private:
         /// return the next char in the stream
@@ -67,7 +84,7 @@ namespace ckalei{
 
         std::string identifierStr; // Filled if tok_identifier
         double numVal{}; // Filled if tok_number
-        int otherChar{}; // Filled if tok_other
+        int otherChar{}; // Filled if tok_other, a character or an OperatorCode
     };
 }
 
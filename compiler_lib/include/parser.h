@@ -14,14 +14,23 @@
 namespace ckalei {
 
     const std::string ANONIMOUS_EXPR = "__anon_expr";
+    /// Maximum nesting depth of an expression, deeper expressions are rejected instead of overflowing the stack. The
+    /// height of the expressions parsed, in nodes, is bounded by it too, operator chains included. Code generation, the
+    /// deepest recursion, takes about 1KB of stack per level in a debug build: half of a default 8MB thread stack
+    const int MAX_NESTING_DEPTH = 4096;
+    /// Maximum precedence of user defined binary operators
+    const int MAX_PRECEDENCE = 1000;
 
     class Parser {
     public:
-        Parser(std::unique_ptr<Lexer> lexer) : lexer(std::move(lexer)), binopPrec(std::map<char, int>())
+        /// Create a parser. precedences holds operators defined before the code of lexer, by a session
+        Parser(std::unique_ptr<Lexer> lexer, const std::map<char, int>& precedences = {}) :
+                lexer(std::move(lexer)), binopPrec(precedences)
         {
 
             // Define operators priority, higher is better
             binopPrec['<'] = 10;
+            binopPrec['>'] = 10;
             binopPrec['+'] = 20;
             binopPrec['-'] = 20;
             binopPrec['*'] = 40;
@@ -32,6 +41,11 @@ namespace ckalei {
     public:
         /// parse input in lexer and get the list of computed ast nodes
         std::vector<std::unique_ptr<ASTNode>> getAstNodes();
+        /// Return the precedence of every binary operator of one character, built in or defined by the parsed code.
+        /// The built in operators of two characters have a fixed precedence
+        [[nodiscard]] const std::map<char, int> &getPrecedences() const {return binopPrec;}
+        /// Return the bytes held by the source text of the lexer
+        [[nodiscard]] std::size_t getSourceBytes() const {return lexer->getSourceBytes();}
 
     private:
         /// Parse top level expression
@@ -81,21 +95,30 @@ namespace ckalei {
         ///     ::= identifier ( expression* )
         std::unique_ptr<ExprAST> parseIdentifierExpr();
 
-        /// Parse unary expression
+        /// Parse unary expression, failing if expressions are nested deeper than MAX_NESTING_DEPTH
         /// unary
         ///     ::= primary
         ///     ::= '!' unary
         std::unique_ptr<ExprAST> parseUnaryExpr();
 
-        /// Parse binary expression
+        /// Parse unary expression, without depth check
+        std::unique_ptr<ExprAST> parseUnaryOrPrimary();
+
+        /// Parse binary expression, each operator counting as one nesting level
         /// exprPrec: precedence of the operator
         /// binoprhs
         ///     ::= ( '+' unary)*
         std::unique_ptr<ExprAST> parseBinOpRhs(int exprPrec, std::unique_ptr<ExprAST> lhs);
 
+        /// Parse an optional type annotation, type is left unchanged if there is none. Return false on error
+        /// typeannotation
+        ///     ::= (':' ('f64' | 'i64' | 'f32'))?
+        bool parseTypeAnnotation(ValueType& type);
+
         /// Parse var declaratiuon expression
         /// declexpr
-        ///     ::= 'var' identifier ('=' expression)? (',' identifier ('=' expression)?)* 'in' expression
+        ///     ::= 'var' identifier typeannotation ('=' expression)?
+        ///         (',' identifier typeannotation ('=' expression)?)* 'in' expression
         std::unique_ptr<ExprAST> parseDeclarationExpr();
 
         /// Parse ifThenElse expression
@@ -106,7 +129,7 @@ namespace ckalei {
 
         /// Parse for loop expression
         /// forLoopExpr
-        ///     ::= 'for' id '=' expression "," expression "," expression "in" expression
+        ///     ::= 'for' id typeannotation '=' expression "," expression "," expression "in" expression
         std::unique_ptr<ExprAST> parseForExpr();
 
 
@@ -114,9 +137,9 @@ namespace ckalei {
     private:
         /// Parse a function prototype of form : fname(arg1 arg2 arg3)
         /// prototype
-        ///     ::= id '(' id* ')'
-        ///     :: unary LETTER (id)
-        ///     :: binary LETTER number (id, id)
+        ///     ::= id '(' (id typeannotation)* ')' typeannotation
+        ///     :: unary LETTER (id typeannotation) typeannotation
+        ///     :: binary LETTER number (id typeannotation, id typeannotation) typeannotation
         std::unique_ptr<PrototypeAST> parsePrototype();
 
         /// Parse a function definition.
@@ -138,6 +161,12 @@ namespace ckalei {
         /// Get the precedence of the current token. return -1 if not registered
         int getTokPrecedence();
 
+        /// Return true if the current token can start a top level item, or is eof
+        bool isTopLevelStart();
+
+        /// Error recovery: skip tokens up to the start of the next top level item
+        void synchronize();
+
 
         /// LogError* - These are little helper functions for error handling.
         std::unique_ptr<ExprAST> logError(const char *Str)
@@ -155,6 +184,7 @@ namespace ckalei {
     private:
         std::unique_ptr<Lexer> lexer;
         Token curTok; // current token
+        int depth = 0; // nesting depth of the expression being parsed
         std::map<char, int> binopPrec;  // defined operators
     };
 
@@ -8,9 +8,17 @@
 #include <string>
 #include <utility>
 #include <memory>
+#include <set>
 
+#include "aot.h"
 #include "parser.h"
+#include "serialize.h"
+#include "stats.h"
 
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/TargetSelect.h"
 
 
@@ -20,18 +28,118 @@ namespace ckalei{
 
     class Program{
     public:
-        Program(const std::string& rawCode): rawCode(rawCode){
+        Program(const std::string& rawCode): rawCode(rawCode), hash(sourceHash(rawCode)){
 
-            llvm::InitializeNativeTarget();
-            llvm::InitializeNativeTargetAsmPrinter();
-            llvm::InitializeNativeTargetAsmParser();
+            initializeTargets();
 
             auto lexer = std::make_unique<Lexer>(rawCode);
             parser = std::make_unique<Parser>(std::move(lexer));
+            auto astBytes = ASTNode::allocatedBytes();
             astData = parser->getAstNodes();
 
+            stats.memory.sourceBytes = this->rawCode.capacity() + parser->getSourceBytes();
+            stats.memory.astBytes = ASTNode::allocatedBytes() - astBytes;
+            stats.memory.peakBytes = stats.memory.total();
+
         };
 
+        /// Create a program from ast nodes built without source text. hash identifies the source they represent
+        explicit Program(std::vector<std::unique_ptr<ASTNode>> nodes, uint64_t hash = 0):
+                astData(std::move(nodes)), hash(hash)
+        {
+            initializeTargets();
+        }
+
+        /// Load a program from a binary ast file written by saveAst. If expectedHash is not 0, the file must come from
+        /// the source of this hash. Return nullptr on error
+        static std::unique_ptr<Program> loadAst(const std::string& path, uint64_t expectedHash = 0)
+        {
+            // large files are memory mapped by the buffer
+            auto buffer = llvm::MemoryBuffer::getFile(path, -1, false);
+            if (!buffer){
+                fprintf(stderr, "LogError: can not read %s: %s\n", path.c_str(), buffer.getError().message().c_str());
+                return nullptr;
+            }
+            auto astBytes = ASTNode::allocatedBytes();
+            auto reader = ASTReader((*buffer)->getBuffer());
+            std::vector<std::unique_ptr<ASTNode>> nodes;
+            if (!reader.read(nodes)){
+                return nullptr;
+            }
+            if (expectedHash && reader.getSourceHash() != expectedHash){
+                fprintf(stderr, "LogError: %s was produced from another source\n", path.c_str());
+                return nullptr;
+            }
+            auto program = std::make_unique<Program>(std::move(nodes), reader.getSourceHash());
+            program->stats.memory.astBytes = ASTNode::allocatedBytes() - astBytes;
+            program->stats.memory.peakBytes = program->stats.memory.total();
+            return program;
+        }
+
+        /// Return the program of rawCode. Its ast is read from cacheDirectory if a previous call cached it there,
+        /// otherwise the source is parsed and, if free of errors, its ast is cached
+        static std::unique_ptr<Program> loadCached(const std::string& rawCode, const std::string& cacheDirectory)
+        {
+            auto hash = sourceHash(rawCode);
+            llvm::SmallString<128> path(cacheDirectory);
+            llvm::sys::path::append(path, llvm::utohexstr(hash) + ".kast");
+            if (llvm::sys::fs::exists(path)){
+                if (auto program = loadAst(path.str().str(), hash)){
+                    return program;
+                }
+            }
+
+            auto program = std::make_unique<Program>(rawCode);
+            for (const auto &node: program->astData){
+                if (!node){
+                    return program;
+                }
+            }
+            program->saveAst(path.str().str());
+            return program;
+        }
+
+        /// Write the binary ast of the program to path, see serialize.h. The file is replaced atomically so that
+        /// concurrent readers never see a partial file. Return false on error
+        bool saveAst(const std::string& path) const
+        {
+            auto data = ASTWriter().write(astData, hash);
+            int fd;
+            llvm::SmallString<128> tmpPath;
+            if (llvm::sys::fs::createUniqueFile(path + ".tmp%%%%%%", fd, tmpPath)){
+                fprintf(stderr, "LogError: can not write %s\n", path.c_str());
+                return false;
+            }
+            llvm::raw_fd_ostream out(fd, true);
+            out << data;
+            out.close();
+            bool failed = out.has_error();
+            out.clear_error();
+            if (failed || llvm::sys::fs::rename(tmpPath, path)){
+                llvm::sys::fs::remove(tmpPath);
+                fprintf(stderr, "LogError: can not write %s\n", path.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        /// Remove the definitions which neither a top level expression nor one of exports reaches, through calls and
+        /// operator uses. Return the number of definitions removed
+        std::size_t pruneUnreachable(const std::set<std::string>& exports = {})
+        {
+            auto reachable = ReachabilityVisitor::findReachable(astData, exports);
+            std::size_t removed = 0;
+            for (std::size_t i = 0; i < astData.size(); i++){
+                if (reachable[i]){
+                    astData[i - removed] = std::move(astData[i]);
+                } else {
+                    removed++;
+                }
+            }
+            astData.resize(astData.size() - removed);
+            return removed;
+        }
+
         /// Return a pprinted representation of the program
         [[nodiscard]] std::string ppformat() const
         {
@@ -51,18 +159,100 @@ namespace ckalei{
             return compiler.getAssembly(astData, debug);
         }
 
-        /// Return a list of double containing the evaluation of the program
-        [[nodiscard]] std::unique_ptr<std::vector<double>> evaluate() const
+        /// Return a string containing the native assembly the jit produces for each definition
+        [[nodiscard]] std::string getNativeAssembly(bool debug=false) const
         {
             auto compiler = CodeGenVisitor();
-            return std::move(compiler.evaluate(astData));
+            return compiler.getNativeAssembly(astData, debug);
+        }
+
+        /// Return a list of double containing the evaluation of the program
+        [[nodiscard]] std::unique_ptr<std::vector<double>> evaluate(const JitOptions& options = {}) const
+        {
+            auto compiler = CodeGenVisitor(options);
+            auto res = compiler.evaluate(astData);
+            recordBackendStats(compiler.getMemoryStats());
+            return res;
         };
 
+        /// Compile every definition ahead of time into a relocatable object file. Return false on error
+        bool emitObject(const std::string& path, const AotOptions& options = {}) const
+        {
+            auto compiler = CodeGenVisitor();
+            return compiler.emitObject(astData, options, path);
+        }
+
+        /// Compile every definition ahead of time into a shared library. Return false on error
+        bool emitSharedLibrary(const std::string& path, const AotOptions& options = {}) const
+        {
+            return emitLinked(path, options, linkSharedLibrary);
+        }
+
+        /// Compile the program ahead of time into an executable printing the value of each top level expression.
+        /// Return false on error
+        bool emitExecutable(const std::string& path, AotOptions options = {}) const
+        {
+            options.emitMain = true;
+            return emitLinked(path, options, linkExecutable);
+        }
+
+        /// Return a C header declaring the functions the program defines, protected by the include guard guard
+        [[nodiscard]] std::string getCHeader(const std::string& guard) const
+        {
+            auto headerVisitor = CHeaderVisitor(guard);
+            for (auto const& node: astData){
+                if (node != nullptr){
+                    node->accept(headerVisitor);
+                }
+            }
+            return headerVisitor.getStr();
+        }
+
+        /// Initialise the native target, required before any code generation
+        static void initializeTargets()
+        {
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+            llvm::InitializeNativeTargetAsmParser();
+        }
+
+        /// Return the statistics gathered by parsing and by the last evaluation
+        [[nodiscard]] const ProgramStats &getStats() const {return stats;}
+
 
     private:
+        /// Emit a temporary object and link it to path with link. Return false on error
+        bool emitLinked(const std::string& path, const AotOptions& options,
+                        bool (*link)(const std::vector<std::string>&, const std::string&)) const
+        {
+            llvm::SmallString<128> object;
+            if (llvm::sys::fs::createTemporaryFile("kaleidoscope", "o", object)){
+                fprintf(stderr, "LogError: can not create a temporary object file\n");
+                return false;
+            }
+            auto objectPath = object.str().str();
+            std::vector<std::string> inputs{objectPath};
+            inputs.insert(inputs.end(), options.libraries.begin(), options.libraries.end());
+            bool success = emitObject(objectPath, options) && link(inputs, path);
+            llvm::sys::fs::remove(objectPath);
+            return success;
+        }
+
+        /// Update the stats with the memory used by a code generation
+        void recordBackendStats(const MemoryStats& backend) const
+        {
+            auto &memory = stats.memory;
+            memory.irBytes = backend.irBytes;
+            memory.jitCodeBytes = backend.jitCodeBytes;
+            memory.jitDataBytes = backend.jitDataBytes;
+            memory.peakBytes = std::max(memory.peakBytes, memory.sourceBytes + memory.astBytes + backend.peakBytes);
+        }
+
         std::string rawCode;
         std::unique_ptr<Parser> parser;
         std::vector<std::unique_ptr<ASTNode>> astData;
+        uint64_t hash; // hash of the source, key of the ast cache
+        mutable ProgramStats stats;
 
     };
 } // ckalei
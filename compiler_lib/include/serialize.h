@@ -0,0 +1,108 @@
+//
+// Compact binary format of the ast, used as a front end cache: a file of this format is read back into ast nodes
+// without lexing nor parsing.
+//
+// file     ::= magic version sourceHash strings nodes
+// magic    ::= "KAST"
+// version  ::= varint
+// sourceHash ::= u64 (xxhash64 of the source text, little endian)
+// strings  ::= varint (varint bytes)*       string table, nodes refer to strings by index
+// nodes    ::= varint node*                 top level nodes
+// node     ::= tag fields, children in the order of the node constructor
+//
+
+#ifndef LLVM_KALEIDOSCOPE_SERIALIZE_H
+#define LLVM_KALEIDOSCOPE_SERIALIZE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+#include "ast.h"
+
+namespace ckalei {
+
+    const char AST_MAGIC[4] = {'K', 'A', 'S', 'T'};
+    /// Version of the binary ast format, to bump on any change of the encoding
+    const uint64_t AST_FORMAT_VERSION = 3;
+
+    /// Tag preceding each serialized node
+    enum ASTTag: uint8_t{
+        tag_number,
+        tag_variable,
+        tag_unary,
+        tag_binary,
+        tag_declaration,
+        tag_call,
+        tag_if,
+        tag_for,
+        tag_prototype,
+        tag_function,
+        tag_integer, // number holding a non negative integer, encoded as a varint
+    };
+
+    /// Return the hash keying the serialized ast of a source
+    uint64_t sourceHash(llvm::StringRef source);
+
+    /// Visitor serializing ast nodes to the binary format
+    class ASTWriter: public Visitor{
+
+    public:
+        void visit(NumberExprAST& node) override;
+        void visit(VariableExprAST& node) override;
+        void visit(UnaryExprAST& node) override;
+        void visit(BinaryExprAST& node) override;
+        void visit(DeclarationExprAST& node) override;
+        void visit(CallExprAST& node) override;
+        void visit(IfExprAST& node) override;
+        void visit(ForExprAST& node) override;
+        void visit(PrototypeAST& node) override;
+        void visit(FunctionAST& node) override;
+
+        /// Return the serialization of the top level nodes of a source of hash hash. Null nodes are skipped
+        std::string write(const std::vector<std::unique_ptr<ASTNode>>& nodes, uint64_t hash);
+
+    private:
+        void writeVarint(uint64_t value);
+        void writeString(const std::string& str);
+
+        std::string body; // serialized nodes
+        std::map<std::string, uint64_t> strings; // string table: index of each string
+        std::vector<const std::string *> stringsOrder; // strings by index
+    };
+
+    /// Reader of the binary ast format. Malformed input is reported and rejected, never trusted.
+    class ASTReader{
+
+    public:
+        explicit ASTReader(llvm::StringRef data): data(data), pos(0){};
+
+        /// Read the top level nodes. Return false if data is not a valid serialized ast
+        bool read(std::vector<std::unique_ptr<ASTNode>>& nodes);
+        /// Return the hash of the source the ast was produced from. Valid once read succeeded
+        [[nodiscard]] uint64_t getSourceHash() const {return hash;}
+
+    private:
+        bool readVarint(uint64_t& value);
+        bool readString(std::string& str);
+        /// Read a type byte. Return false if it is truncated or not a ValueType
+        bool readType(ValueType& type);
+        std::unique_ptr<ExprAST> readExpr();
+        std::unique_ptr<PrototypeAST> readPrototype();
+        std::unique_ptr<FunctionAST> readFunction();
+        /// Log an error and return nullptr
+        std::nullptr_t logError(const char *str);
+
+        llvm::StringRef data;
+        std::size_t pos;
+        uint64_t hash{};
+        int depth{};
+        std::vector<std::string> strings;
+    };
+}
+
+#endif //LLVM_KALEIDOSCOPE_SERIALIZE_H
@@ -0,0 +1,75 @@
+//
+// Interactive session: a jit living across evaluations, which can be saved to a snapshot and restored without
+// compiling again.
+//
+
+#ifndef LLVM_KALEIDOSCOPE_SESSION_H
+#define LLVM_KALEIDOSCOPE_SESSION_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "program.h"
+
+namespace ckalei {
+
+    const char SNAPSHOT_MAGIC[4] = {'K', 'S', 'N', 'P'};
+    /// Version of the snapshot format, to bump on any change of the encoding
+    const uint64_t SNAPSHOT_FORMAT_VERSION = 5;
+
+    /// A session evaluates successive pieces of code: the functions, externs and operators they define stay
+    /// available to the next ones.
+    ///
+    /// A snapshot stores the operator precedences, the prototypes, the operators expanded at their uses with the
+    /// definitions which expanded them, and the objects compiled by the session. It is restored only by a build of the
+    /// same format and LLVM version, for the same target triple, cpu and features. Snapshots are trusted: their
+    /// objects are loaded as they are.
+    ///
+    /// Definitions loaded with loadSharedCode are compiled once per host into a position independent shared library
+    /// of a cache directory. Every process loading them maps the same read only file, so their code pages are shared
+    /// by the processes instead of being compiled and held by each jit. Only the relocation tables of the library are
+    /// private to a process. A library links to the libraries of the shared code loaded before it, and its symbols are
+    /// only found by the session which loaded it and by its clones.
+    class Session{
+
+    public:
+        explicit Session(const JitOptions& options = {});
+
+        /// Parse and evaluate code. Return the values of its top level expressions
+        std::unique_ptr<std::vector<double>> evaluate(const std::string& code);
+
+        /// Return a session sharing the compiled code, prototypes and operators of this one without copying them.
+        /// Definitions made in the clone, redefinitions included, are invisible to this session and freed with the
+        /// clone. The clone sees the new definitions of this session unless it redefines them.
+        std::unique_ptr<Session> clone();
+
+        /// Load the definitions of code from a shared library of cacheDirectory, compiling it there if no process did
+        /// yet. code can only hold definitions and externs, and call functions of the process or of the shared code
+        /// loaded before it. Return false on error
+        bool loadSharedCode(const std::string& code, const std::string& cacheDirectory);
+
+        /// Write a snapshot of the session to path. Return false on error
+        bool saveSnapshot(const std::string& path);
+        /// Restore a session from a snapshot, compiling the code evaluated afterward with options. Return nullptr on
+        /// error or if the snapshot is not compatible
+        static std::unique_ptr<Session> loadSnapshot(const std::string& path, const JitOptions& options = {});
+
+        /// Return the precedence of the binary operators known by the session
+        [[nodiscard]] const std::map<char, int> &getPrecedences() const {return precedences;}
+
+    private:
+        explicit Session(std::unique_ptr<CodeGenVisitor> compiler);
+
+        /// Return the description of the target the objects are compiled for, checked when restoring
+        [[nodiscard]] std::vector<std::string> targetDescription() const;
+
+        std::unique_ptr<CodeGenVisitor> compiler;
+        std::map<char, int> precedences;
+        std::vector<std::string> sharedLibraries; // loaded by loadSharedCode, in load order, by absolute path
+        std::vector<PrototypeAST> sharedPrototypes; // declared or defined by the shared code, in load order
+    };
+}
+
+#endif //LLVM_KALEIDOSCOPE_SESSION_H
@@ -0,0 +1,33 @@
+//
+// Statistics gathered while compiling and running a program
+//
+
+#ifndef LLVM_KALEIDOSCOPE_STATS_H
+#define LLVM_KALEIDOSCOPE_STATS_H
+
+#include <cstddef>
+
+namespace ckalei {
+
+    /// Bytes used by each subsystem of a program
+    struct MemoryStats{
+        std::size_t sourceBytes = 0; // copies of the source text (program and lexer)
+        std::size_t astBytes = 0; // ast nodes
+        std::size_t irBytes = 0; // estimated size of the largest module handed to the jit
+        std::size_t jitCodeBytes = 0; // code sections allocated by the jit
+        std::size_t jitDataBytes = 0; // data sections allocated by the jit
+        std::size_t peakBytes = 0; // peak of the sum of the above
+
+        [[nodiscard]] std::size_t total() const
+        {
+            return sourceBytes + astBytes + irBytes + jitCodeBytes + jitDataBytes;
+        }
+    };
+
+    /// Statistics of a program
+    struct ProgramStats{
+        MemoryStats memory;
+    };
+}
+
+#endif //LLVM_KALEIDOSCOPE_STATS_H
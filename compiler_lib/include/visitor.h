@@ -5,8 +5,10 @@
 #ifndef LLVM_KALEIDOSCOPE_VISITOR_H
 #define LLVM_KALEIDOSCOPE_VISITOR_H
 
+#include <functional>
 #include <iostream>
 #include <map>
+#include <set>
 
 
 
@@ -16,18 +18,23 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
 
 #include "llvm/Transforms/InstCombine/InstCombine.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
 #include "llvm/Transforms/Utils.h"
 
+#include "aot.h"
 #include "ast.h"
+#include "stats.h"
 #include "KaleidoscopeJIT.h"
 
 namespace ckalei{
 
     class ASTNode;
+    class ExprAST;
     class NumberExprAST;
     class VariableExprAST;
     class UnaryExprAST;
@@ -39,6 +46,10 @@ namespace ckalei{
     class PrototypeAST;
     class FunctionAST;
 
+    /// Variables of a function holding exact integers, see IntegerVisitor: loops, with index 0, and the variables of
+    /// declarations by index
+    using IntegerVariables = std::set<std::pair<const ExprAST*, std::size_t>>;
+
     class Visitor{
     public:
         virtual void visit(NumberExprAST& node) = 0;
@@ -53,11 +64,71 @@ namespace ckalei{
         virtual void visit(FunctionAST& node) = 0;
     };
 
+    /// Options of the jit compilation
+    struct JitOptions{
+        /// Estimated IR bytes of consecutive definitions compiled together as one module, 0 to compile each
+        /// definition alone. Larger modules share the module setup, code generation and linking costs
+        std::size_t moduleBudget = 0;
+        /// Compile all the definitions of an evaluation into one module optimised as a whole, like link time
+        /// optimisation, for non interactive use. Every definition is internalised, except the entry points: the
+        /// others can be inlined, specialised or removed, and are not callable from later evaluations
+        bool wholeProgram = false;
+        std::vector<std::string> entryPoints;
+        /// Threads generating, optimising and compiling consecutive definitions in parallel, 1 to compile on the
+        /// calling thread only
+        unsigned threads = 1;
+        /// Estimated IR bytes from which a module is split in one part per thread, compiled to machine code in
+        /// parallel. Only modules batching many definitions reach it, see moduleBudget and wholeProgram
+        std::size_t splitBytes = 1 << 20;
+        /// Bind the arguments and variables never assigned with '=' to their SSA values, and the loop variables to
+        /// phi nodes: only assigned variables live in allocas. false stores every variable in an alloca and leaves
+        /// them to mem2reg, which the debug mode does not run
+        bool directSsa = true;
+        /// Expand the small user defined operators at their uses, their arguments bound once like the ones of a
+        /// call, instead of calling them. The functions which expanded an operator are compiled again when it is
+        /// redefined, to see the new definition like the functions calling it
+        bool inlineOperators = true;
+        /// Generate the loop variables and counters holding exact integers as i64, see IntegerVisitor. Their values
+        /// are converted to doubles where they are used, loops on them get integer induction variables
+        bool inferIntegers = true;
+        /// Keep one context, builder and pass pipeline for all the modules of a code generator. false creates them
+        /// again for each module, to measure the setup cost they save
+        bool reuseContext = true;
+    };
+
+    /// Definitions of a code generator in the jit: a layer of modules and the prototypes they define, overlaid on
+    /// the layer it was cloned from
+    struct CodeLayer{
+        CodeLayer(std::shared_ptr<llvm::orc::KaleidoscopeJIT> jit, std::shared_ptr<CodeLayer> base);
+        /// Remove the modules of the layer from the jit
+        ~CodeLayer();
+
+        /// Return the prototype of name in this layer or the layers below it, nullptr if not found
+        [[nodiscard]] PrototypeAST *findPrototype(const std::string& name) const;
+        /// Return the definition of the operator name expanded at its uses in this layer or the layers below it,
+        /// nullptr if the operator is called
+        [[nodiscard]] FunctionAST *findInlineOperator(const std::string& name) const;
+        /// Return the definitions of this layer which expanded the operator name. The ones of the layers below keep the
+        /// operator of their layer, as their calls resolve in it
+        [[nodiscard]] std::vector<std::shared_ptr<FunctionAST>> findInlineCallers(const std::string& name) const;
+
+        std::shared_ptr<llvm::orc::KaleidoscopeJIT> jit;
+        std::shared_ptr<CodeLayer> base; // kept alive by the layers cloned from it
+        llvm::orc::KaleidoscopeJIT::LayerKey key;
+        std::map<std::string, std::unique_ptr<PrototypeAST>> prototypes;
+        // copies of the operator definitions, null for the ones too large to expand
+        std::map<std::string, std::unique_ptr<FunctionAST>> inlineOperators;
+        // copies of the definitions which expanded each operator, by operator and definition name
+        std::map<std::string, std::map<std::string, std::shared_ptr<FunctionAST>>> inlineCallers;
+        // handles of the shared libraries loaded in the layer, closed with it
+        std::vector<std::shared_ptr<void>> libraries;
+    };
+
     /// Visitor for code generation
     class CodeGenVisitor: public Visitor{
 
     public:
-        CodeGenVisitor();
+        explicit CodeGenVisitor(const JitOptions& options = {});
         /// Generate code for NumberExpr. Set lastValue.
         void visit(NumberExprAST& node) override;
         /// Generate code for VariableExpr. Set lastValue.
@@ -82,26 +153,132 @@ namespace ckalei{
     public:
         /// Return assembly transcript of the astData. If debug is true, deactivate optimisation pass
         [[nodiscard]] std::string getAssembly(const std::vector<std::unique_ptr<ASTNode>>& astData, bool debug=false);
+        /// Return the native assembly the target machine emits for each definition of astData, after the
+        /// optimisation passes. If debug is true, deactivate optimisation pass
+        [[nodiscard]] std::string getNativeAssembly(const std::vector<std::unique_ptr<ASTNode>>& astData, bool debug=false);
         /// Return an evaluation of the current node. Valid only if current node is an expression
         std::unique_ptr<std::vector<double>> evaluate(const std::vector<std::unique_ptr<ASTNode>>& astData);
+        /// Return the memory used by the generated IR and the jit. Front end fields are left empty.
+        [[nodiscard]] MemoryStats getMemoryStats() const;
+        /// Return the target machine of the jit
+        [[nodiscard]] const llvm::TargetMachine &getTargetMachine() const {return layer->jit->getTargetMachine();}
+        /// Return a code generator sharing the compiled code and prototypes of this one, and adding its own
+        /// definitions over them. Definitions added to either one afterward are invisible to the other, except for
+        /// the clone seeing the new definitions of its base which it does not redefine
+        std::unique_ptr<CodeGenVisitor> clone();
+        /// Keep a copy of the objects the jit compiles from now on, for snapshots
+        void recordObjects();
+        /// Compile the pending definitions and return the objects recorded, in load order. Evaluated top level
+        /// expressions are not kept
+        std::vector<llvm::MemoryBufferRef> getRecordedObjects();
+        /// Load an object compiled by another jit for the same target. Its functions must be declared with
+        /// addPrototype to be called
+        void addObject(std::unique_ptr<llvm::MemoryBuffer> object);
+        /// Load a shared library whose symbols are found by the code of this generator and of its clones, but not by
+        /// the rest of the process. Its functions must be declared with addPrototype to be called. Return false on
+        /// error
+        bool loadLibrary(const std::string& path);
+        /// Declare a function compiled elsewhere
+        void addPrototype(const PrototypeAST& proto);
+        /// Return the prototypes of the functions defined or declared so far, including the ones of the base layers
+        [[nodiscard]] std::map<std::string, const PrototypeAST*> getPrototypes() const;
+        /// Return the operator definitions expanded at their uses, including the ones of the base layers, by name.
+        /// The ones too large to expand are null
+        [[nodiscard]] std::map<std::string, const FunctionAST*> getInlineOperators() const;
+        /// Return the definitions which expanded each operator, by operator and definition name, including the ones
+        /// of the base layers which are not redefined above them
+        [[nodiscard]] std::map<std::string, std::map<std::string, const FunctionAST*>> getInlineCallers() const;
+        /// Expand the operator definition, compiled elsewhere, at its uses compiled from now on
+        void addInlineOperator(const FunctionAST& definition);
+        /// Compile definition again when the operator op is redefined, like the definitions which expanded it
+        void addInlineCaller(const std::string& op, const FunctionAST& definition);
+        /// Compile every definition of astData ahead of time into a relocatable object file written at path.
+        /// Top level expressions get internal linkage, and are called by a main if options ask for it.
+        /// Return false on error
+        bool emitObject(const std::vector<std::unique_ptr<ASTNode>>& astData, const AotOptions& options,
+                        const std::string& path);
 
     private:
+        CodeGenVisitor(std::shared_ptr<CodeLayer> layer, const JitOptions& options);
         /// Return computed assembly code for lastFunc
         [[nodiscard]] std::string ppformat() const;
+        /// Return native assembly code for lastFunc. Declarations produce no code.
+        [[nodiscard]] std::string nativeFormat() const;
+        /// Enable or disable optimisation passes, rebuilding the pass manager if the mode changed
+        void setDebug(bool debugMode);
+        /// Return the end of the definitions from astData[begin] which can be compiled in parallel: none calls a
+        /// definition after it, so they can be split anywhere, and none redefines a function
+        std::size_t findParallelDefinitions(const std::vector<std::unique_ptr<ASTNode>>& astData, std::size_t begin);
+        /// Compile the definitions astData[begin, end) in parallel and add them to the jit in order
+        void compileParallel(const std::vector<std::unique_ptr<ASTNode>>& astData, std::size_t begin,
+                             std::size_t end);
+        /// Generate definitions in the module and compile it for targetMachine. Return nullptr if no code was
+        /// generated
+        std::unique_ptr<llvm::MemoryBuffer> compileDefinitions(const std::vector<FunctionAST*>& definitions,
+                                                               llvm::TargetMachine& targetMachine);
+        /// Evaluate astData compiled as a single module, see JitOptions::wholeProgram
+        std::unique_ptr<std::vector<double>> evaluateWholeProgram(const std::vector<std::unique_ptr<ASTNode>>& astData);
         /// Top level handling of top level expression
         void handleTopLevelExpression(FunctionAST& node);
         /// Top level handling of function definition
         void handleTopLevelDefinition(FunctionAST& node);
         /// Top level handling of extern declaration
         void handleTopLevelExtern(PrototypeAST& node);
+        /// Generate expr as an i1 condition. Comparisons and logic operators give it directly, other values are
+        /// compared to 0. Return nullptr on error
+        llvm::Value *generateCondition(ExprAST& expr);
+        /// Generate a short circuit && or || as an i1
+        llvm::Value *generateLogicalOp(BinaryExprAST& node);
+        /// Return the definition to expand for a use of the operator name, nullptr to call it. An operator is not
+        /// expanded within its own expansion
+        FunctionAST *findInlineOperator(const std::string& name);
+        /// Generate the body of an operator definition with its arguments bound to args, in place of a call. args
+        /// must have the types of the parameters
+        llvm::Value *expandOperator(FunctionAST& definition, const std::vector<llvm::Value *>& args);
+        /// Record a copy of the operator definition in target, to be expanded by the uses compiled after it
+        static void defineInlineOperator(const FunctionAST& definition, CodeLayer& target);
+        /// Record a copy of definition, just compiled, as a caller of the operators it expanded
+        void recordInlineCallers(const FunctionAST& definition);
         /// Search for the Function IR for the given name. First search in the current module, then in the declared
         /// functionProto map. It not found, return nullptr.
         llvm::Function *getFunction(const std::string& name);
+        /// Return the signature of the functions declared by proto
+        llvm::FunctionType *getFunctionType(const PrototypeAST& proto);
+        /// Return false if proto redeclares a known function with another signature: the code compiled before it is
+        /// bound to the known one
+        bool matchesKnownSignature(const PrototypeAST& proto);
+        /// Return value, the value of expr, as a value of type. Only number literals are converted implicitly, other
+        /// values need an explicit conversion. Return nullptr on a type mismatch
+        llvm::Value *coerce(ExprAST& expr, llvm::Value *value, llvm::Type *type);
+        /// Give the operands lhs and rhs the same type: a number literal takes the type of the other operand.
+        /// Return false on a type mismatch
+        bool unifyTypes(ExprAST& lhsExpr, llvm::Value *&lhs, ExprAST& rhsExpr, llvm::Value *&rhs);
+        /// Coerce args, the values of the argument expressions exprs, to the parameter types of signature. Return false
+        /// on a type mismatch
+        bool coerceArguments(const std::vector<ExprAST*>& exprs, std::vector<llvm::Value *>& args,
+                             llvm::FunctionType *signature);
+        /// Explicitly convert value to type, as the toi64(), tof32() and tof64() conversions do. Floating point values
+        /// saturate to the bounds of i64, NaN converts to 0
+        llvm::Value *convert(llvm::Value *value, llvm::Type *type);
+        /// Generate lhs / rhs on i64: a zero divisor traps, INT64_MIN / -1 wraps to INT64_MIN
+        llvm::Value *generateIntegerDivision(llvm::Value *lhs, llvm::Value *rhs);
+        /// Return true if expr is cheap and can be evaluated unconditionally, see CostVisitor
+        bool isSpeculatable(ExprAST& expr);
+        /// Return true if expr can be generated as an i64 by generateInteger: an integer literal or a variable of
+        /// integerVariables
+        bool isIntegerOperand(ExprAST& expr);
+        /// Generate an integer literal, a variable of integerVariables, or their sums and differences as an i64
+        llvm::Value *generateInteger(ExprAST& expr);
         /// Create an alloca instruction in the entry block of the function.
         /// Used for mutable variables
-        llvm::AllocaInst *createEntryBlockAlloca(llvm::Function *function, const std::string &varName){
+        llvm::AllocaInst *createEntryBlockAlloca(llvm::Function *function, const std::string &varName,
+                                                 llvm::Type *type){
             llvm::IRBuilder<> tmpBuilder(&function->getEntryBlock(), function->getEntryBlock().begin());
-            return tmpBuilder.CreateAlloca(llvm::Type::getDoubleTy(*context), nullptr, varName);
+            return tmpBuilder.CreateAlloca(type, nullptr, varName);
+        }
+        /// Return true if the variable name needs an alloca instead of being bound to its value
+        [[nodiscard]] bool needsAlloca(const std::string& name) const {
+            return !options.directSsa || assignedVariables.count(name);
         }
 
         /// Log an error durring code creation
@@ -109,25 +286,57 @@ namespace ckalei{
             fprintf(stderr, "LogError: %s\n", str);
             return nullptr;
         }
-        /// Initialise a new module and its associated context and pass manager. To be called after each expression
-        /// Creation
-        void initModuleAndPassManager();
+        /// Start a new module in the context of the code generator. To be called after each module handed to the jit
+        void initModule();
+        /// Build the function pass pipeline of the current mode
+        void initPassManager();
+        /// Hand the current module to the jit and start a new one. Return the keys of the module in the jit, one per
+        /// part of a split module, none if it held no code
+        std::vector<llvm::orc::VModuleKey> flushModule();
+        /// Split a module in one part per thread, compile the parts in parallel and add their objects to the jit.
+        /// Return the keys of the parts
+        std::vector<llvm::orc::VModuleKey> addSplitModule(std::unique_ptr<llvm::Module> whole);
+        /// Create a main running the expressions in order and printing their results through the runtime
+        bool createMain(const std::vector<llvm::Function *>& expressions);
+        /// Return an estimation of the bytes used by the IR of a module
+        static std::size_t estimateModuleBytes(const llvm::Module& module);
+        /// Return an estimation of the bytes used by the IR of a function
+        static std::size_t estimateFunctionBytes(const llvm::Function& function);
 
-        std::unique_ptr<llvm::orc::KaleidoscopeJIT> jit;
+        std::shared_ptr<CodeLayer> layer;
+        JitOptions options;
 
         llvm::Value* lastValue{}; // Contain the last value if defined
         llvm::Function* lastFunction{}; // Contain the last function if defined
+        // The context, builder and pass pipeline are kept for every module unless options disable it: the jit frees
+        // a module once compiled, types and constants stay uniqued in the context
         std::unique_ptr<llvm::LLVMContext> context;
         std::unique_ptr<llvm::IRBuilder<>> builder;
         std::unique_ptr<llvm::Module> module;
-        std::map<llvm::StringRef, llvm::AllocaInst *> namedValues; // Contain reference to named values in context
-        std::map<std::string, std::unique_ptr<PrototypeAST>> functionProtos;
+        llvm::DataLayout dataLayout;
+        // Values of the variables in scope: the alloca holding an assigned variable, the value itself otherwise
+        std::map<llvm::StringRef, llvm::Value *> namedValues;
+        std::set<std::string> assignedVariables; // by '=' in the function generated, they need an alloca
+        IntegerVariables integerVariables; // of the function generated, generated as i64
+        std::set<const llvm::Value *> integerBindings; // values and allocas of the variables of integerVariables
+        std::set<std::string> expandedOperators; // operators being expanded
+        std::set<std::string> operatorsExpanded; // by the function generated
+        std::set<std::string> recompiledCallers; // compiled again after the redefinition of an operator
 
-        std::unique_ptr<llvm::legacy::FunctionPassManager> passManager;
+        llvm::LoopAnalysisManager loopAnalyses;
+        llvm::FunctionAnalysisManager functionAnalyses;
+        llvm::CGSCCAnalysisManager cgsccAnalyses;
+        llvm::ModuleAnalysisManager moduleAnalyses;
+        llvm::FunctionPassManager passManager;
         std::unique_ptr<std::vector<double>> evaluationRes;
 
         bool jitTopLevel;
         bool debug;
+        int anonymousExprCount{}; // top level expressions renamed to share a module
+        std::size_t pendingBytes{}; // estimated IR bytes of the definitions waiting in the module
+
+        std::size_t irPeakBytes{}; // estimated size of the largest module handed to the jit
+        std::size_t peakBytes{}; // peak of IR and jit sections
     };
 
     /// Visitor for producing prety print of ast
@@ -205,6 +414,192 @@ namespace ckalei{
         std::string str;
     };
 
+    /// Visitor producing a C header declaring the functions a program defines. Externs are imported, not defined,
+    /// and operators have no C name: both are skipped.
+    class CHeaderVisitor: public Visitor{
+
+    public:
+        explicit CHeaderVisitor(std::string guard): guard(std::move(guard)){};
+
+        // Expressions declare nothing
+        void visit(NumberExprAST&) override {}
+        void visit(VariableExprAST&) override {}
+        void visit(UnaryExprAST&) override {}
+        void visit(BinaryExprAST&) override {}
+        void visit(DeclarationExprAST&) override {}
+        void visit(CallExprAST&) override {}
+        void visit(IfExprAST&) override {}
+        void visit(ForExprAST&) override {}
+        void visit(PrototypeAST&) override {}
+        /// Declare the function once
+        /// $type $name($type $args, ...);
+        void visit(FunctionAST& node) override;
+
+        /// Return the header: guard, extern "C" block and declarations
+        [[nodiscard]] std::string getStr() const;
+
+    private:
+        std::string guard;
+        std::string declarations;
+        std::set<std::string> declared;
+    };
+
+    /// Visitor estimating the cost of evaluating an expression unconditionally, in built in operations. Calls,
+    /// user defined operators, assignments, declarations and loops may have side effects or be arbitrarily long:
+    /// an expression using them is not speculatable
+    class CostVisitor: public Visitor{
+
+    public:
+        void visit(NumberExprAST&) override {integer = false;}
+        void visit(VariableExprAST& node) override;
+        void visit(UnaryExprAST&) override {speculatable = false;}
+        void visit(BinaryExprAST& node) override;
+        void visit(DeclarationExprAST&) override {speculatable = false;}
+        void visit(CallExprAST& node) override;
+        void visit(IfExprAST& node) override;
+        void visit(ForExprAST&) override {speculatable = false;}
+        void visit(PrototypeAST&) override {speculatable = false;}
+        void visit(FunctionAST&) override {speculatable = false;}
+
+        /// Return true if expr has no side effect, can not trap and costs at most budget operations. isInteger tells
+        /// if a variable is an i64: an integer division may trap
+        static bool isSpeculatable(ExprAST& expr, int budget,
+                                   const std::function<bool(const std::string&)>& isInteger = nullptr);
+
+    private:
+        std::function<bool(const std::string&)> isInteger;
+        int cost = 0;
+        bool speculatable = true;
+        bool integer = false; // the expression visited last is an i64
+    };
+
+    /// Visitor computing the height of an expression, in nodes, as bounded by MAX_NESTING_DEPTH
+    class HeightVisitor: public Visitor{
+
+    public:
+        void visit(NumberExprAST&) override {height = 1;}
+        void visit(VariableExprAST&) override {height = 1;}
+        void visit(UnaryExprAST& node) override;
+        void visit(BinaryExprAST& node) override;
+        void visit(DeclarationExprAST& node) override;
+        void visit(CallExprAST& node) override;
+        void visit(IfExprAST& node) override;
+        void visit(ForExprAST& node) override;
+        void visit(PrototypeAST&) override {}
+        void visit(FunctionAST&) override {}
+
+        /// Return the height of expr, 0 if it is null
+        int measure(const std::unique_ptr<ExprAST>& expr);
+
+    private:
+        int height = 0;
+    };
+
+    /// Visitor copying expressions
+    class CloneVisitor: public Visitor{
+
+    public:
+        void visit(NumberExprAST& node) override;
+        void visit(VariableExprAST& node) override;
+        void visit(UnaryExprAST& node) override;
+        void visit(BinaryExprAST& node) override;
+        void visit(DeclarationExprAST& node) override;
+        void visit(CallExprAST& node) override;
+        void visit(IfExprAST& node) override;
+        void visit(ForExprAST& node) override;
+        void visit(PrototypeAST&) override {}
+        void visit(FunctionAST&) override {}
+
+        /// Return a deep copy of expr. If nodes is not null, add the number of nodes copied to it
+        static std::unique_ptr<ExprAST> clone(ExprAST& expr, std::size_t *nodes = nullptr);
+
+    private:
+        std::unique_ptr<ExprAST> copyOf(ExprAST& expr);
+
+        std::unique_ptr<ExprAST> result;
+        std::size_t nodes = 0;
+    };
+
+    /// Visitor finding the variables a function assigns with '='. Names are not resolved to their declarations: a
+    /// name assigned anywhere in the function is reported for all its bindings
+    class AssignmentVisitor: public Visitor{
+
+    public:
+        void visit(NumberExprAST&) override {}
+        void visit(VariableExprAST&) override {}
+        void visit(UnaryExprAST& node) override;
+        void visit(BinaryExprAST& node) override;
+        void visit(DeclarationExprAST& node) override;
+        void visit(CallExprAST& node) override;
+        void visit(IfExprAST& node) override;
+        void visit(ForExprAST& node) override;
+        void visit(PrototypeAST&) override {}
+        void visit(FunctionAST& node) override;
+
+        /// Return the names of the variables assigned in the body of function
+        static std::set<std::string> findAssigned(FunctionAST& function);
+
+    private:
+        std::set<std::string> assigned;
+    };
+
+    /// Visitor proving which variables of a function hold exact integers, stored as doubles: the loop variables
+    /// starting from an integer literal, stepping by a small one and never assigned, and the counters declared with
+    /// an integer literal, or 0, and only assigned literals or themselves plus or minus a small literal. Like
+    /// AssignmentVisitor, names are not resolved: an assignment counts for all the bindings of its name
+    class IntegerVisitor: public Visitor{
+
+    public:
+        void visit(NumberExprAST&) override {}
+        void visit(VariableExprAST&) override {}
+        void visit(UnaryExprAST& node) override;
+        void visit(BinaryExprAST& node) override;
+        void visit(DeclarationExprAST& node) override;
+        void visit(CallExprAST& node) override;
+        void visit(IfExprAST& node) override;
+        void visit(ForExprAST& node) override;
+        void visit(PrototypeAST&) override {}
+        void visit(FunctionAST& node) override;
+
+        /// Return the loop variables and counters of function holding exact integers
+        static IntegerVariables findIntegers(FunctionAST& function);
+
+    private:
+        /// Return true if assigning value to the variable name keeps it an integer
+        static bool isCounterUpdate(const std::string& name, const ExprAST& value);
+
+        std::set<std::string> assigned; // names assigned with '='
+        std::set<std::string> nonCounters; // names assigned values which may not be integers
+        std::vector<const ForExprAST*> loops; // candidate loops
+        std::vector<std::pair<const DeclarationExprAST*, std::size_t>> counters; // candidate declared variables
+    };
+
+    /// Visitor building the call graph of a program, from the calls and the operator uses of the function bodies, to
+    /// find the definitions its top level expressions can reach
+    class ReachabilityVisitor: public Visitor{
+
+    public:
+        void visit(NumberExprAST&) override {}
+        void visit(VariableExprAST&) override {}
+        void visit(UnaryExprAST& node) override;
+        void visit(BinaryExprAST& node) override;
+        void visit(DeclarationExprAST& node) override;
+        void visit(CallExprAST& node) override;
+        void visit(IfExprAST& node) override;
+        void visit(ForExprAST& node) override;
+        void visit(PrototypeAST&) override {}
+        /// Add the callees of the body to the ones of the function
+        void visit(FunctionAST& node) override;
+
+        /// Return for each node of astData whether it must be compiled: externs, top level expressions, exports and
+        /// the definitions they reach. Every definition of a reachable name is kept
+        static std::vector<bool> findReachable(const std::vector<std::unique_ptr<ASTNode>>& astData,
+                                               const std::set<std::string>& exports);
+
+    private:
+        std::map<std::string, std::set<std::string>> callGraph;
+        std::set<std::string> *callees{}; // of the function visited
+    };
 }
 
 #endif //LLVM_KALEIDOSCOPE_VISITOR_H
@@ -0,0 +1,71 @@
+//
+// Runtime of the standalone executables: buffered output for the results of top level expressions and the
+// printing functions Kaleidoscope programs can declare as extern. Math comes from libm.
+//
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define KAL_BUFFER_SIZE 65536
+
+static char buffer[KAL_BUFFER_SIZE];
+static size_t used = 0;
+
+/// Write the buffered output to stdout
+int kal_flush(void)
+{
+    size_t written = 0;
+    while (written < used){
+        ssize_t res = write(STDOUT_FILENO, buffer + written, used - written);
+        if (res <= 0){
+            used = 0;
+            return 1;
+        }
+        written += (size_t) res;
+    }
+    used = 0;
+    return 0;
+}
+
+/// Append a formatted double to the buffer, with the given printf format
+static void append(const char *format, double value)
+{
+    int length = snprintf(NULL, 0, format, value);
+    if (length < 0){
+        return;
+    }
+    // snprintf also writes a terminating null
+    if (KAL_BUFFER_SIZE - used <= (size_t) length){
+        kal_flush();
+    }
+    // a value larger than the whole buffer is written directly
+    if ((size_t) length >= KAL_BUFFER_SIZE){
+        dprintf(STDOUT_FILENO, format, value);
+        return;
+    }
+    snprintf(buffer + used, KAL_BUFFER_SIZE - used, format, value);
+    used += (size_t) length;
+}
+
+/// Print the result of a top level expression, formatted like the jit does
+void kal_print_result(double value)
+{
+    append("%g\n", value);
+}
+
+/// Print a double and a new line. Return 0
+double printd(double value)
+{
+    append("%f\n", value);
+    return 0;
+}
+
+/// Print the character of code value. Return 0
+double putchard(double value)
+{
+    if (used == KAL_BUFFER_SIZE){
+        kal_flush();
+    }
+    buffer[used++] = (char) value;
+    return 0;
+}
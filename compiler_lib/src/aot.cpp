@@ -0,0 +1,102 @@
+//
+// Ahead of time compilation: target selection and linking of the emitted objects
+//
+
+#include "aot.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetRegistry.h"
+
+namespace ckalei{
+
+    /// Return the code generation level matching an optimisation level
+    static llvm::CodeGenOpt::Level codeGenOptLevel(unsigned optLevel)
+    {
+        switch (optLevel) {
+            case 0:
+                return llvm::CodeGenOpt::None;
+            case 1:
+                return llvm::CodeGenOpt::Less;
+            case 2:
+                return llvm::CodeGenOpt::Default;
+            default:
+                return llvm::CodeGenOpt::Aggressive;
+        }
+    }
+
+    std::unique_ptr<llvm::TargetMachine> createAotTargetMachine(const AotOptions &options)
+    {
+        if (options.optLevel > MAX_OPT_LEVEL){
+            fprintf(stderr, "LogError: optimisation level %u is above %u\n", options.optLevel, MAX_OPT_LEVEL);
+            return nullptr;
+        }
+        auto triple = llvm::sys::getDefaultTargetTriple();
+        std::string error;
+        auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+        if (!target){
+            fprintf(stderr, "LogError: %s\n", error.c_str());
+            return nullptr;
+        }
+
+        std::string cpu = options.cpu;
+        std::string features;
+        if (cpu == "native"){
+            cpu = llvm::sys::getHostCPUName().str();
+            llvm::StringMap<bool> hostFeatures;
+            if (llvm::sys::getHostCPUFeatures(hostFeatures)){
+                llvm::SubtargetFeatures subtargetFeatures;
+                for (const auto &feature: hostFeatures){
+                    subtargetFeatures.AddFeature(feature.first(), feature.second);
+                }
+                features = subtargetFeatures.getString();
+            }
+        }
+
+        llvm::TargetOptions targetOptions;
+        auto machine = target->createTargetMachine(triple, cpu, features, targetOptions, llvm::Reloc::PIC_,
+                                                   llvm::None, codeGenOptLevel(options.optLevel));
+        if (!machine){
+            fprintf(stderr, "LogError: can not create a target machine for %s\n", cpu.c_str());
+        }
+        return std::unique_ptr<llvm::TargetMachine>(machine);
+    }
+
+    /// Run the system compiler driver with args. Return false on error
+    static bool runCompilerDriver(const std::vector<std::string>& args)
+    {
+        auto driver = llvm::sys::findProgramByName("cc");
+        if (!driver){
+            fprintf(stderr, "LogError: no system compiler (cc) found to link with\n");
+            return false;
+        }
+        std::vector<llvm::StringRef> argv{*driver};
+        argv.insert(argv.end(), args.begin(), args.end());
+
+        std::string error;
+        auto status = llvm::sys::ExecuteAndWait(*driver, argv, llvm::None, {}, 0, 0, &error);
+        if (status != 0){
+            fprintf(stderr, "LogError: link failed %s\n", error.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool linkSharedLibrary(const std::vector<std::string>& objects, const std::string& output)
+    {
+        std::vector<std::string> args{"-shared", "-o", output};
+        args.insert(args.end(), objects.begin(), objects.end());
+        return runCompilerDriver(args);
+    }
+
+    bool linkExecutable(const std::vector<std::string>& objects, const std::string& output)
+    {
+        std::vector<std::string> args{"-o", output};
+        args.insert(args.end(), objects.begin(), objects.end());
+        args.emplace_back(KALEIDOSCOPE_RUNTIME);
+        args.emplace_back("-lm");
+        return runCompilerDriver(args);
+    }
+}
@@ -3,8 +3,98 @@
 //
 
 #include "ast.h"
+
+#include <cctype>
+
 namespace ckalei{
 
+    // Nodes are parsed by the thread owning the program, a per thread counter is enough. Only differences of the
+    // counter are used: a node freed by another thread, like the prototypes of parallel compilation, wraps it around
+    // without changing them
+    static thread_local std::size_t astAllocatedBytes = 0;
+
+    void *ASTNode::operator new(std::size_t size)
+    {
+        astAllocatedBytes += size;
+        return ::operator new(size);
+    }
+
+    void ASTNode::operator delete(void *ptr, std::size_t size)
+    {
+        astAllocatedBytes -= size;
+        ::operator delete(ptr);
+    }
+
+    std::size_t ASTNode::allocatedBytes()
+    {
+        return astAllocatedBytes;
+    }
+
+    std::string typeName(ValueType type)
+    {
+        switch (type){
+            case type_i64:
+                return "i64";
+            case type_f32:
+                return "f32";
+            default:
+                return "f64";
+        }
+    }
+
+    bool typeFromName(const std::string &name, ValueType &type)
+    {
+        for (int candidate = 0; candidate <= type_last; candidate++){
+            if (name == typeName((ValueType) candidate)){
+                type = (ValueType) candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool conversionFromName(const std::string &callee, ValueType &type)
+    {
+        return callee.rfind("to", 0) == 0 && typeFromName(callee.substr(2), type);
+    }
+
+    bool isBuiltinBinaryOp(int op)
+    {
+        return (op >= op_le && op <= op_last) || std::string("+-*/<>=").find((char) op) != std::string::npos;
+    }
+
+    bool isBooleanBinaryOp(int op)
+    {
+        return (op >= op_le && op <= op_last) || op == '<' || op == '>';
+    }
+
+    /// Characters the lexer never hands to the parser as an operator
+    static const std::string RESERVED_CHARS = "(),;#";
+
+    bool isOperatorChar(char op)
+    {
+        auto c = (unsigned char) op;
+        return isprint(c) && !isalnum(c) && !isspace(c) && c != '.' && RESERVED_CHARS.find(op) == std::string::npos;
+    }
+
+    bool isIdentifier(const std::string &name)
+    {
+        static const char *keywords[] = {"def", "extern", "if", "then", "else", "for", "in", "binary", "unary", "var"};
+        if (name.empty() || !isalpha((unsigned char) name[0])){
+            return false;
+        }
+        for (auto c: name){
+            if (!isalnum((unsigned char) c)){
+                return false;
+            }
+        }
+        for (const auto *keyword: keywords){
+            if (name == keyword){
+                return false;
+            }
+        }
+        return true;
+    }
 
     void NumberExprAST::accept(Visitor &visitor)
     {visitor.visit(*this);}
@@ -0,0 +1,461 @@
+//
+// Builder of programs from C++
+//
+
+#include "builder.h"
+
+#include <cmath>
+
+namespace ckalei{
+
+    /// Check the variables, calls and types of a function body, the way code generation resolves them
+    class ScopeChecker: public Visitor{
+
+    public:
+        ScopeChecker(const std::map<std::string, PrototypeAST>& prototypes, const PrototypeAST& proto):
+                prototypes(prototypes)
+        {
+            for (std::size_t i = 0; i < proto.getArgs().size(); i++){
+                scope[proto.getArgs()[i]].push_back(proto.getArgType(i));
+            }
+        }
+
+        /// Check body, which must have the return type of the function unless it is a top level expression
+        void check(const PrototypeAST& proto, ExprAST& body)
+        {
+            body.accept(*this);
+            if (proto.getName() != ANONIMOUS_EXPR){
+                coerce(body, type, proto.getReturnType());
+            }
+        }
+
+        void visit(NumberExprAST&) override {type = type_f64;}
+
+        void visit(VariableExprAST& node) override
+        {
+            const auto &bindings = scope[node.getName()];
+            if (bindings.empty()){
+                logError("Unknown variable name " + node.getName());
+                type = type_f64;
+                return;
+            }
+            type = bindings.back();
+        }
+
+        void visit(UnaryExprAST& node) override
+        {
+            checkCall(std::string("unary") + node.getOpcode(), {node.getExpr().get()});
+        }
+
+        void visit(BinaryExprAST& node) override
+        {
+            auto &lhs = *node.getLeftExpr();
+            auto &rhs = *node.getRightExpr();
+            if (!isBuiltinBinaryOp(node.getOp())){
+                checkCall(std::string("binary") + (char) node.getOp(), {&lhs, &rhs});
+                return;
+            }
+            lhs.accept(*this);
+            auto lhsType = type;
+            rhs.accept(*this);
+            // the value is converted to the type of the variable
+            if (node.getOp() == '='){
+                coerce(rhs, type, lhsType);
+                type = lhsType;
+                return;
+            }
+            // logic operators test each operand on its own, comparisons are doubles when used as a value
+            if (node.getOp() != op_and && node.getOp() != op_or){
+                type = unify(lhs, lhsType, rhs, type);
+            }
+            if (isBooleanBinaryOp(node.getOp())){
+                type = type_f64;
+            }
+        }
+
+        void visit(DeclarationExprAST& node) override
+        {
+            // each variable is bound once its value is computed
+            const auto &vars = node.getVars();
+            for (std::size_t i = 0; i < vars.size(); i++){
+                if (vars[i].second){
+                    vars[i].second->accept(*this);
+                    coerce(*vars[i].second, type, node.getType(i));
+                }
+                scope[vars[i].first].push_back(node.getType(i));
+            }
+            node.getBody()->accept(*this);
+            for (const auto &var: vars){
+                scope[var.first].pop_back();
+            }
+        }
+
+        void visit(CallExprAST& node) override
+        {
+            std::vector<ExprAST*> args;
+            for (const auto &arg: node.getArgs()){
+                args.push_back(arg.get());
+            }
+            checkCall(node.getCallee(), args);
+        }
+
+        void visit(IfExprAST& node) override
+        {
+            node.getCond()->accept(*this);
+            node.getIfExpr()->accept(*this);
+            auto ifType = type;
+            node.getElseExpr()->accept(*this);
+            type = unify(*node.getIfExpr(), ifType, *node.getElseExpr(), type);
+        }
+
+        void visit(ForExprAST& node) override
+        {
+            auto varType = node.getVarType();
+            node.getStart()->accept(*this);
+            coerce(*node.getStart(), type, varType);
+            scope[node.getVarName()].push_back(varType);
+            node.getBody()->accept(*this);
+            node.getStep()->accept(*this);
+            coerce(*node.getStep(), type, varType);
+            node.getEnd()->accept(*this);
+            scope[node.getVarName()].pop_back();
+            type = type_f64;
+        }
+
+        void visit(PrototypeAST&) override {}
+        void visit(FunctionAST&) override {}
+
+        int errors = 0;
+
+    private:
+        /// Check a call of name with args, and set the type to its result
+        void checkCall(const std::string& name, const std::vector<ExprAST*>& args)
+        {
+            // conversions toi64(x), tof32(x) and tof64(x) accept any type
+            ValueType conversion;
+            if (conversionFromName(name, conversion)){
+                if (args.size() != 1){
+                    logError("A conversion takes one argument");
+                }
+                for (auto *arg: args){
+                    arg->accept(*this);
+                }
+                type = conversion;
+                return;
+            }
+            auto it = prototypes.find(name);
+            const PrototypeAST *proto = it == prototypes.end() ? nullptr : &it->second;
+            if (!proto){
+                logError("Function not found " + name);
+            } else if (proto->getArgs().size() != args.size()){
+                logError("Invalid number of arguments for " + name);
+                proto = nullptr;
+            }
+            for (std::size_t i = 0; i < args.size(); i++){
+                args[i]->accept(*this);
+                if (proto){
+                    coerce(*args[i], type, proto->getArgType(i));
+                }
+            }
+            type = proto ? proto->getReturnType() : type_f64;
+        }
+
+        /// Check that expr of type from can be used as a value of type to: number literals take the type they are
+        /// used as
+        void coerce(ExprAST& expr, ValueType from, ValueType to)
+        {
+            // an expression with an error has no type to check
+            if (from == to || errors){
+                return;
+            }
+            auto *number = dynamic_cast<NumberExprAST*>(&expr);
+            if (!number){
+                logError("Type mismatch, convert explicitly with toi64(), tof32() or tof64()");
+                return;
+            }
+            auto val = number->getVal();
+            if (to == type_i64 && (val != std::trunc(val) || !(val >= -0x1p63 && val < 0x1p63))){
+                logError("Number literal is not an i64");
+            }
+        }
+
+        /// Return the common type of two operands, a number literal takes the type of the other one
+        ValueType unify(ExprAST& lhs, ValueType lhsType, ExprAST& rhs, ValueType rhsType)
+        {
+            if (dynamic_cast<NumberExprAST*>(&rhs)){
+                coerce(rhs, rhsType, lhsType);
+                return lhsType;
+            }
+            coerce(lhs, lhsType, rhsType);
+            return rhsType;
+        }
+
+        void logError(const std::string& str)
+        {
+            fprintf(stderr, "LogError: %s\n", str.c_str());
+            errors++;
+        }
+
+        const std::map<std::string, PrototypeAST>& prototypes;
+        std::map<std::string, std::vector<ValueType>> scope; // types of the bindings of each name, innermost last
+        ValueType type = type_f64; // type of the last expression checked
+    };
+
+    /// Return true if a and b have the same arguments and return types, as code generation compares them
+    static bool sameSignature(const PrototypeAST& a, const PrototypeAST& b)
+    {
+        if (a.getArgs().size() != b.getArgs().size() || a.getReturnType() != b.getReturnType()){
+            return false;
+        }
+        for (std::size_t i = 0; i < a.getArgs().size(); i++){
+            if (a.getArgType(i) != b.getArgType(i)){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::nullptr_t ASTBuilder::logError(const std::string &str)
+    {
+        fprintf(stderr, "LogError: %s\n", str.c_str());
+        errors++;
+        return nullptr;
+    }
+
+    std::unique_ptr<ExprAST> ASTBuilder::number(double val)
+    {
+        return std::make_unique<NumberExprAST>(val);
+    }
+
+    std::unique_ptr<ExprAST> ASTBuilder::variable(const std::string &name)
+    {
+        if (!isIdentifier(name)){
+            return logError("Invalid variable name " + name);
+        }
+        return std::make_unique<VariableExprAST>(name);
+    }
+
+    std::unique_ptr<ExprAST> ASTBuilder::unary(char op, std::unique_ptr<ExprAST> expr)
+    {
+        if (!isOperatorChar(op)){
+            return logError(std::string("Invalid unary operator ") + op);
+        }
+        if (!expr){
+            return nullptr;
+        }
+        return std::make_unique<UnaryExprAST>(op, std::move(expr));
+    }
+
+    std::unique_ptr<ExprAST> ASTBuilder::binary(int op, std::unique_ptr<ExprAST> lhs, std::unique_ptr<ExprAST> rhs)
+    {
+        if (op == '='){
+            return logError("Use assign for '='");
+        }
+        if (op < op_le ? !isOperatorChar((char) op) : op > op_last){
+            return logError("Invalid binary operator " + operatorSpelling(op));
+        }
+        if (!lhs || !rhs){
+            return nullptr;
+        }
+        return std::make_unique<BinaryExprAST>(std::move(lhs), std::move(rhs), op);
+    }
+
+    std::unique_ptr<ExprAST> ASTBuilder::assign(const std::string &name, std::unique_ptr<ExprAST> value)
+    {
+        auto var = variable(name);
+        if (!var || !value){
+            return nullptr;
+        }
+        return std::make_unique<BinaryExprAST>(std::move(var), std::move(value), '=');
+    }
+
+    std::unique_ptr<ExprAST> ASTBuilder::call(const std::string &callee, std::vector<std::unique_ptr<ExprAST>> args)
+    {
+        if (!isIdentifier(callee)){
+            return logError("Invalid function name " + callee);
+        }
+        for (const auto &arg: args){
+            if (!arg){
+                return nullptr;
+            }
+        }
+        return std::make_unique<CallExprAST>(callee, std::move(args));
+    }
+
+    std::unique_ptr<ExprAST> ASTBuilder::ifThenElse(std::unique_ptr<ExprAST> cond, std::unique_ptr<ExprAST> ifExpr,
+                                                    std::unique_ptr<ExprAST> elseExpr)
+    {
+        if (!cond || !ifExpr || !elseExpr){
+            return nullptr;
+        }
+        return std::make_unique<IfExprAST>(std::move(cond), std::move(ifExpr), std::move(elseExpr));
+    }
+
+    std::unique_ptr<ExprAST> ASTBuilder::forLoop(const std::string &varName, std::unique_ptr<ExprAST> start,
+                                                 std::unique_ptr<ExprAST> end, std::unique_ptr<ExprAST> step,
+                                                 std::unique_ptr<ExprAST> body, ValueType varType)
+    {
+        if (!isIdentifier(varName)){
+            return logError("Invalid variable name " + varName);
+        }
+        if (!start || !end || !step || !body){
+            return nullptr;
+        }
+        return std::make_unique<ForExprAST>(std::move(start), std::move(step), std::move(end), std::move(body),
+                                            varName, varType);
+    }
+
+    std::unique_ptr<ExprAST> ASTBuilder::declaration(std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> vars,
+                                                     std::unique_ptr<ExprAST> body, std::vector<ValueType> types)
+    {
+        if (vars.empty()){
+            return logError("A declaration needs at least one variable");
+        }
+        if (!types.empty() && types.size() != vars.size()){
+            return logError("A declaration needs one type per variable");
+        }
+        for (const auto &var: vars){
+            if (!isIdentifier(var.first)){
+                return logError("Invalid variable name " + var.first);
+            }
+        }
+        if (!body){
+            return nullptr;
+        }
+        return std::make_unique<DeclarationExprAST>(std::move(body), std::move(vars), std::move(types));
+    }
+
+    bool ASTBuilder::addNode(const std::string &name, std::vector<std::string> args,
+                             std::vector<ValueType> argTypes, ValueType returnType, std::unique_ptr<ExprAST> body,
+                             bool isOperator, int precedence)
+    {
+        ValueType conversion;
+        if (conversionFromName(name, conversion)){
+            logError("Can not redefine a type conversion " + name);
+            return false;
+        }
+        for (const auto &arg: args){
+            if (!isIdentifier(arg)){
+                logError("Invalid argument name " + arg);
+                return false;
+            }
+        }
+        if (!argTypes.empty() && argTypes.size() != args.size()){
+            logError("Invalid number of argument types for " + name);
+            return false;
+        }
+        auto proto = std::make_unique<PrototypeAST>(name, std::move(args), isOperator, precedence, std::move(argTypes),
+                                                    returnType);
+        auto known = prototypes.find(name);
+        if (known != prototypes.end() && !sameSignature(known->second, *proto)){
+            logError("Function definition does not match its declaration " + name);
+            return false;
+        }
+
+        // extern
+        if (!body){
+            prototypes.insert_or_assign(name, *proto);
+            nodes.push_back(std::move(proto));
+            return true;
+        }
+
+        // the bound of the parser, which the ast files of the program are read with
+        if (HeightVisitor().measure(body) > MAX_NESTING_DEPTH){
+            logError("Expression nesting too deep in " + name);
+            return false;
+        }
+        // the function is visible from its body for recursion
+        std::map<std::string, PrototypeAST> bodyPrototypes(prototypes);
+        bodyPrototypes.insert_or_assign(name, *proto);
+        ScopeChecker checker(bodyPrototypes, *proto);
+        checker.check(*proto, *body);
+        if (checker.errors){
+            errors += checker.errors;
+            return false;
+        }
+        if (name != ANONIMOUS_EXPR){
+            prototypes.insert_or_assign(name, *proto);
+        }
+        nodes.push_back(std::make_unique<FunctionAST>(std::move(proto), std::move(body)));
+        return true;
+    }
+
+    bool ASTBuilder::addExtern(const std::string &name, std::vector<std::string> args, std::vector<ValueType> argTypes,
+                               ValueType returnType)
+    {
+        if (!isIdentifier(name)){
+            logError("Invalid function name " + name);
+            return false;
+        }
+        return addNode(name, std::move(args), std::move(argTypes), returnType, nullptr);
+    }
+
+    bool ASTBuilder::addFunction(const std::string &name, std::vector<std::string> args, std::unique_ptr<ExprAST> body,
+                                 std::vector<ValueType> argTypes, ValueType returnType)
+    {
+        if (!isIdentifier(name)){
+            logError("Invalid function name " + name);
+            return false;
+        }
+        if (!body){
+            logError("Missing body of " + name);
+            return false;
+        }
+        return addNode(name, std::move(args), std::move(argTypes), returnType, std::move(body));
+    }
+
+    bool ASTBuilder::addBinaryOperator(char op, int precedence, const std::string &lhs, const std::string &rhs,
+                                       std::unique_ptr<ExprAST> body, std::vector<ValueType> argTypes,
+                                       ValueType returnType)
+    {
+        if (!isOperatorChar(op) || isBuiltinBinaryOp(op)){
+            logError(std::string("Invalid binary operator ") + op);
+            return false;
+        }
+        if (precedence < 1 || precedence > MAX_PRECEDENCE){
+            logError("Precedence must be between 1 and " + std::to_string(MAX_PRECEDENCE));
+            return false;
+        }
+        if (!body){
+            logError(std::string("Missing body of binary ") + op);
+            return false;
+        }
+        return addNode(std::string("binary") + op, {lhs, rhs}, std::move(argTypes), returnType, std::move(body),
+                       true, precedence);
+    }
+
+    bool ASTBuilder::addUnaryOperator(char op, const std::string &arg, std::unique_ptr<ExprAST> body,
+                                      std::vector<ValueType> argTypes, ValueType returnType)
+    {
+        if (!isOperatorChar(op)){
+            logError(std::string("Invalid unary operator ") + op);
+            return false;
+        }
+        if (!body){
+            logError(std::string("Missing body of unary ") + op);
+            return false;
+        }
+        return addNode(std::string("unary") + op, {arg}, std::move(argTypes), returnType, std::move(body), true);
+    }
+
+    bool ASTBuilder::addExpression(std::unique_ptr<ExprAST> body)
+    {
+        if (!body){
+            logError("Missing top level expression");
+            return false;
+        }
+        return addNode(ANONIMOUS_EXPR, {}, {}, type_f64, std::move(body));
+    }
+
+    std::unique_ptr<Program> ASTBuilder::build()
+    {
+        std::unique_ptr<Program> program;
+        if (!errors){
+            program = std::make_unique<Program>(std::move(nodes));
+        }
+        nodes.clear();
+        prototypes.clear();
+        errors = 0;
+        return program;
+    }
+}
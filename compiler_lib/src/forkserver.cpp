@@ -0,0 +1,67 @@
+//
+// Fork server
+//
+
+#include "forkserver.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "llvm/Support/FileSystem.h"
+
+namespace ckalei{
+
+    /// Return the number of threads of the process, 0 if unknown
+    static std::size_t countThreads()
+    {
+        std::size_t count = 0;
+        std::error_code error;
+        for (llvm::sys::fs::directory_iterator it("/proc/self/task", error), end; it != end && !error;
+             it.increment(error)){
+            count++;
+        }
+        return error ? 0 : count;
+    }
+
+    ForkServer::ForkServer(const std::string &prelude): session(std::make_unique<Session>())
+    {
+        session->evaluate(prelude);
+    }
+
+    ForkServer::ForkServer(std::unique_ptr<Session> session): session(std::move(session)) {}
+
+    pid_t ForkServer::spawn(const std::function<int(Session&)>& work)
+    {
+        if (countThreads() > 1){
+            fprintf(stderr, "LogError: can not fork workers from a multi threaded process\n");
+            return -1;
+        }
+        // buffered output would be written by both processes
+        fflush(nullptr);
+        auto pid = fork();
+        if (pid < 0){
+            perror("LogError: fork");
+            return -1;
+        }
+        if (pid == 0){
+            auto code = work(*session);
+            fflush(nullptr);
+            // skip the destructors and exit handlers, the server owns the state they would release
+            _exit(code);
+        }
+        return pid;
+    }
+
+    int ForkServer::wait(pid_t pid)
+    {
+        int status;
+        while (waitpid(pid, &status, 0) < 0){
+            if (errno != EINTR){
+                return -1;
+            }
+        }
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+}
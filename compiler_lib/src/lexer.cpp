@@ -2,20 +2,31 @@
 // Created by maxence on 21/03/2021.
 //
 
+#include <algorithm>
+
 #include "lexer.h"
 namespace ckalei{
 
     Token Lexer::getTok()
     {
 
-        // skip whitespace
-        while (isspace(lastChar)){
-            lastChar = nextChar();
+        // skip whitespace and comments. Comments are skipped in a loop: recursing once per comment would let a long
+        // run of comment lines overflow the stack
+        while (true){
+            while (isspace(lastChar)){
+                lastChar = nextChar();
+            }
+            if (lastChar != '#'){
+                break;
+            }
+            do {
+                lastChar = nextChar();
+            } while (lastChar != '\n' && lastChar != EOF && lastChar != '\r');
         }
 
         // parse identifier (token starting with alpha num)
         if (isalpha(lastChar)){
-            identifierStr = "";
+            identifierStr.clear(); // keep the buffer, identifiers are lexed without allocation once it is large enough
             identifierStr += lastChar;
 
             while (isalnum(lastChar = nextChar())){
@@ -48,24 +59,23 @@ namespace ckalei{
 
         // parse number (token starting with [0-9,.])
         if (isdigit(lastChar) || lastChar == '.'){
-            std::string numStr;
+            auto numStart = iteText - 1; // lastChar has already been read
             do {
-                numStr += lastChar;
                 lastChar = nextChar();
             } while (isdigit(lastChar) || lastChar == '.');
-            numVal = strtod(numStr.c_str(), nullptr);
-            return tok_number;
-        }
+            auto numEnd = lastChar == EOF ? iteText : iteText - 1;
 
-        // parse comment
-        if (lastChar == '#'){
-            do {
-                lastChar = nextChar();
-            } while (lastChar != '\n' && lastChar != EOF && lastChar != '\r');
-
-            if (lastChar != EOF){
-                return getTok();
+            // strtod needs a terminated string: copy the number in a stack buffer unless it is too long
+            char numBuffer[64];
+            auto numLength = numEnd - numStart;
+            if (numLength < (long) sizeof(numBuffer)){
+                std::copy(numStart, numEnd, numBuffer);
+                numBuffer[numLength] = '\0';
+                numVal = strtod(numBuffer, nullptr);
+            } else {
+                numVal = strtod(std::string(numStart, numEnd).c_str(), nullptr);
             }
+            return tok_number;
         }
 
         if (lastChar == EOF){
@@ -74,13 +84,42 @@ namespace ckalei{
 
         otherChar = lastChar;
         lastChar = nextChar();
+        for (int op = op_le; op <= op_last; op++){
+            auto spelling = operatorSpelling(op);
+            if (otherChar == spelling[0] && lastChar == spelling[1]){
+                otherChar = op;
+                lastChar = nextChar();
+                break;
+            }
+        }
         return tok_other;
     }
 
+    std::string operatorSpelling(int op)
+    {
+        switch (op){
+            case op_le:
+                return "<=";
+            case op_ge:
+                return ">=";
+            case op_eq:
+                return "==";
+            case op_ne:
+                return "!=";
+            case op_and:
+                return "&&";
+            case op_or:
+                return "||";
+            default:
+                return std::string(1, (char) op);
+        }
+    }
+
     int Lexer::nextChar()
     {
         if (iteText != inputText.end()){
-            return *(iteText++);
+            // as unsigned char: a 0xFF byte must not read as EOF, nor negative chars reach the ctype functions
+            return (unsigned char) *(iteText++);
         }
         return EOF;
     }
@@ -5,6 +5,7 @@
 #include "parser.h"
 
 namespace ckalei {
+
     Token Parser::getNextToken()
     {
         return curTok = lexer->getTok();
@@ -24,7 +25,7 @@ namespace ckalei {
         if (!content){ // if there is nothing between parenthesis
             return nullptr;
         }
-        if (lexer->getOtherChar() != ')'){
+        if (curTok != tok_other || lexer->getOtherChar() != ')'){
             return logError("expected ')'");
         }
         getNextToken();
@@ -38,20 +39,24 @@ namespace ckalei {
         getNextToken();
 
         if (curTok!= tok_other || lexer->getOtherChar() != '('){ // this is not an function call
-            return std::make_unique<VariableExprAST>(idName);
+            return std::make_unique<VariableExprAST>(std::move(idName));
         }
 
         // this is a function call
         getNextToken(); // eat (
         auto args = std::vector<std::unique_ptr<ExprAST>>();
         while (curTok != tok_other || lexer->getOtherChar() != ')'){
-            args.push_back(parseExpr());
-        }
-        if (curTok != tok_other || lexer->getOtherChar() != ')'){
-            return logError("expected ')'");
+            if (curTok == tok_eof){
+                return logError("expected ')'");
+            }
+            auto arg = parseExpr();
+            if (!arg){
+                return nullptr;
+            }
+            args.push_back(std::move(arg));
         }
         getNextToken(); // eat )
-        return std::make_unique<CallExprAST>(idName, std::move(args));
+        return std::make_unique<CallExprAST>(std::move(idName), std::move(args));
     }
 
     std::unique_ptr<ExprAST> Parser::parsePrimary()
@@ -77,10 +82,15 @@ namespace ckalei {
     {
         auto lhs = parseUnaryExpr();
         if (!lhs){
-            getNextToken();
             return nullptr;
         }
-        return parseBinOpRhs(0, std::move(lhs));
+        auto expr = parseBinOpRhs(0, std::move(lhs));
+        // operator chains deepen the operands parsed before them: check the height of whole expressions, bounded by
+        // the nesting limits to twice MAX_NESTING_DEPTH
+        if (expr && depth == 0 && HeightVisitor().measure(expr) > MAX_NESTING_DEPTH){
+            return logError("expression nesting too deep");
+        }
+        return expr;
     }
 
     int Parser::getTokPrecedence()
@@ -90,6 +100,20 @@ namespace ckalei {
         }
 
         int currentChar = lexer->getOtherChar();
+        switch (currentChar){
+            case op_or:
+                return 4;
+            case op_and:
+                return 5;
+            case op_eq:
+            case op_ne:
+                return 9;
+            case op_le:
+            case op_ge:
+                return 10;
+            default:
+                break;
+        }
         if (!isascii(currentChar)){
             return -1;
         }
@@ -101,27 +125,57 @@ namespace ckalei {
     }
 
     std::unique_ptr<ExprAST> Parser::parseUnaryExpr()
+    {
+        // Every nested expression goes through here: bound the nesting to bound the recursion
+        if (depth >= MAX_NESTING_DEPTH){
+            return logError("expression nesting too deep");
+        }
+        depth++;
+        auto expr = parseUnaryOrPrimary();
+        depth--;
+        return expr;
+    }
+
+    std::unique_ptr<ExprAST> Parser::parseUnaryOrPrimary()
     {
         if (curTok != tok_other){
             return std::move(parsePrimary());
         } else {
-            char op = (char) lexer->getOtherChar();
+            int op = lexer->getOtherChar();
             if (op == '(' || op == ','){
                 return std::move(parsePrimary());
             }
+            if (op >= op_le){
+                return logError("Binary operator used as a unary operator");
+            }
             getNextToken(); // eat op
             auto expr = parseUnaryExpr();
-            return std::make_unique<UnaryExprAST>(op, std::move(expr));
+            if (!expr){
+                return nullptr;
+            }
+            return std::make_unique<UnaryExprAST>((char) op, std::move(expr));
         }
     }
 
     std::unique_ptr<ExprAST> Parser::parseBinOpRhs(int exprPrec, std::unique_ptr<ExprAST> lhs)
     {
+        // each operator nests the chain parsed so far one level deeper: the chain counts in the nesting depth until
+        // it is complete
+        struct ChainGuard{
+            int &depth;
+            int length = 0;
+            ~ChainGuard(){depth -= length;}
+        } chain{depth};
         while (true){
             int tokPrec = getTokPrecedence();
             if (tokPrec < exprPrec){
                 return lhs;
             }
+            if (depth >= MAX_NESTING_DEPTH){
+                return logError("expression nesting too deep");
+            }
+            depth++;
+            chain.length++;
             // here we know we have a bin expression
             int binaryOp = lexer->getOtherChar();
             getNextToken();
@@ -140,10 +194,25 @@ namespace ckalei {
         }
     }
 
+    bool Parser::parseTypeAnnotation(ValueType &type)
+    {
+        if (curTok != tok_other || lexer->getOtherChar() != ':'){
+            return true;
+        }
+        getNextToken(); // eat ':'
+        if (curTok != tok_identifier || !typeFromName(lexer->getIdentifier(), type)){
+            logError("Expected type f64, i64 or f32");
+            return false;
+        }
+        getNextToken(); // eat type
+        return true;
+    }
+
     std::unique_ptr<ExprAST> Parser::parseDeclarationExpr()
     {
         getNextToken(); // eat 'var'
         std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> vars;
+        std::vector<ValueType> types;
         // parse var list
         while (true){
             if (curTok != tok_identifier){
@@ -151,17 +220,29 @@ namespace ckalei {
             }
             auto varName = lexer->getIdentifier();
             getNextToken(); // eat var name
+            auto type = type_f64;
+            if (!parseTypeAnnotation(type)){
+                return nullptr;
+            }
+            // types stay empty as long as all variables are f64
+            if (type != type_f64 || !types.empty()){
+                types.resize(vars.size(), type_f64);
+                types.push_back(type);
+            }
             std::unique_ptr<ExprAST> varVal = nullptr;
             if (curTok == tok_other && lexer->getOtherChar() == '='){
                 getNextToken(); // eat '='
                 varVal = parseExpr();
+                if (!varVal){
+                    return nullptr;
+                }
             }
-            vars.emplace_back(varName, std::move(varVal));
+            vars.emplace_back(std::move(varName), std::move(varVal));
             if (curTok == tok_in){
                 getNextToken(); // eat 'in'
                 break;
             } else{
-                if (curTok != tok_other && lexer->getOtherChar() != ','){return logError("Expected ','");}
+                if (curTok != tok_other || lexer->getOtherChar() != ','){return logError("Expected ','");}
                 getNextToken(); // eat ','
             }
         }
@@ -171,7 +252,7 @@ namespace ckalei {
         if (!body){
             return logError("invalid body");
         }
-        return std::make_unique<DeclarationExprAST>(std::move(body), std::move(vars));
+        return std::make_unique<DeclarationExprAST>(std::move(body), std::move(vars), std::move(types));
     }
 
     std::unique_ptr<ExprAST> Parser::parseIfThenElse()
@@ -216,8 +297,12 @@ namespace ckalei {
         }
         auto varName = lexer->getIdentifier();
         getNextToken(); // eat identifier
+        auto varType = type_f64;
+        if (!parseTypeAnnotation(varType)){
+            return nullptr;
+        }
 
-        if (curTok != tok_other && lexer->getOtherChar() != '='){
+        if (curTok != tok_other || lexer->getOtherChar() != '='){
             return logError("Expected '='");
         }
         getNextToken(); // eat '='
@@ -227,7 +312,7 @@ namespace ckalei {
         if (not startExpr){
             return logError("startExpr content is invalid");
         }
-        if (curTok != tok_other && lexer->getOtherChar() != ','){
+        if (curTok != tok_other || lexer->getOtherChar() != ','){
             return logError("Expected ','");
         }
         getNextToken(); // eat ','
@@ -237,7 +322,7 @@ namespace ckalei {
         if (not endExpr){
             return logError("endExpr content is invalid");
         }
-        if (curTok != tok_other && lexer->getOtherChar() != ','){
+        if (curTok != tok_other || lexer->getOtherChar() != ','){
             return logError("Expected ','");
         }
         getNextToken(); // eat ','
@@ -262,7 +347,8 @@ namespace ckalei {
                                             std::move(stepExpr),
                                             std::move(endExpr),
                                             std::move(bodyExpr),
-                                            varName);
+                                            std::move(varName),
+                                            varType);
     }
 
     enum ProtoKind{
@@ -281,18 +367,23 @@ namespace ckalei {
 
         if (curTok == tok_identifier){
             name = lexer->getIdentifier();
+            ValueType conversion;
+            if (conversionFromName(name, conversion)){return logErrorP("Can not redefine a type conversion");}
             getNextToken();
             kind = ProtoKind::function;
         } else if (curTok == tok_binary) {// Parse a binary op declaration : "binary" LETTER number
             getNextToken(); // eat binary
             if (curTok != tok_other){return logErrorP("expected operator");}
             name = "binary";
+            // the definition of a built in operator would never be called, but would change its precedence
+            if (isBuiltinBinaryOp(lexer->getOtherChar())){return logErrorP("Can not redefine a built in operator");}
             char op = (char) lexer->getOtherChar();
             name.push_back(op);
             isOperator = true;
             getNextToken(); // eat operator name
             if (curTok != tok_number){return logErrorP("Expected precedence");}
             if (lexer->getNumVal() < 1){return logErrorP("Precedence must be > 1");}
+            if (lexer->getNumVal() > MAX_PRECEDENCE){return logErrorP("Precedence is too high");}
             precedence = (int) lexer->getNumVal();
             getNextToken(); // eat precedence val
             kind = ProtoKind::binary;
@@ -300,6 +391,7 @@ namespace ckalei {
         } else if (curTok == tok_unary){ // Parse unary operator declaration
             getNextToken(); // eat unary
             if (curTok != tok_other){return logErrorP("expected operator");}
+            if (lexer->getOtherChar() >= op_le){return logErrorP("Can not redefine a built in operator");}
             char op = (char) lexer->getOtherChar();
             name = "unary";
             name.push_back(op);
@@ -314,17 +406,34 @@ namespace ckalei {
         if (curTok != tok_other || lexer->getOtherChar() != '('){return logErrorP("Expected (");}
 
         auto argNames = std::vector<std::string>();
-        while (getNextToken() == tok_identifier){
+        auto argTypes = std::vector<ValueType>();
+        getNextToken(); // eat (
+        while (curTok == tok_identifier){
             argNames.push_back(lexer->getIdentifier());
+            getNextToken(); // eat arg name
+            auto type = type_f64;
+            if (!parseTypeAnnotation(type)){
+                return nullptr;
+            }
+            // argTypes stay empty as long as all arguments are f64
+            if (type != type_f64 || !argTypes.empty()){
+                argTypes.resize(argNames.size() - 1, type_f64);
+                argTypes.push_back(type);
+            }
         }
         if (curTok != tok_other || lexer->getOtherChar() != ')'){return logErrorP("Expected )");};
         getNextToken(); // eat )
+        auto returnType = type_f64;
+        if (!parseTypeAnnotation(returnType)){
+            return nullptr;
+        }
 
         // Check args number consistency
         if (kind == binary && argNames.size() != 2){ return logErrorP("Binary op need two args");}
         else if (kind == unary && argNames.size() != 1){ return logErrorP("Binary op need one arg");}
 
-        return std::make_unique<PrototypeAST>(name, std::move(argNames), isOperator, precedence);
+        return std::make_unique<PrototypeAST>(std::move(name), std::move(argNames), isOperator, precedence,
+                                              std::move(argTypes), returnType);
     }
 
     std::unique_ptr<FunctionAST> Parser::parseDefinition()
@@ -356,13 +465,32 @@ namespace ckalei {
                 return res;
             } else if (curTok == tok_def){
                 res.push_back(std::move(parseDefinition()));
-            } else if(curTok == tok_other && lexer->getOtherChar() == ';')
-                {getNextToken();}// do nothing
-            else if (curTok == tok_extern){
+            } else if(curTok == tok_other && lexer->getOtherChar() == ';'){
+                getNextToken(); // do nothing
+                continue;
+            } else if (curTok == tok_extern){
                 res.push_back(std::move(parseExtern()));
             } else{
                 res.push_back(std::move(parseTopLevelExpr()));
             }
+            if (!res.back()){
+                synchronize();
+            }
+        }
+    }
+
+    bool Parser::isTopLevelStart()
+    {
+        return curTok == tok_eof || curTok == tok_def || curTok == tok_extern
+            || (curTok == tok_other && lexer->getOtherChar() == ';');
+    }
+
+    void Parser::synchronize()
+    {
+        // A failed item always consumed its first token unless it failed on it. If it stopped on the start of the
+        // next item there is nothing to skip, otherwise skip up to it. Every token is read once.
+        while (!isTopLevelStart()){
+            getNextToken();
         }
     }
 }
@@ -0,0 +1,533 @@
+//
+// Compact binary format of the ast
+//
+
+#include "serialize.h"
+
+#include <cmath>
+
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/xxhash.h"
+
+#include "parser.h"
+
+namespace ckalei{
+
+    uint64_t sourceHash(llvm::StringRef source)
+    {
+        return llvm::xxHash64(source);
+    }
+
+    void ASTWriter::writeVarint(uint64_t value)
+    {
+        uint8_t buffer[16];
+        auto size = llvm::encodeULEB128(value, buffer);
+        body.append((const char *) buffer, size);
+    }
+
+    void ASTWriter::writeString(const std::string &str)
+    {
+        auto inserted = strings.emplace(str, stringsOrder.size());
+        if (inserted.second){
+            stringsOrder.push_back(&inserted.first->first);
+        }
+        writeVarint(inserted.first->second);
+    }
+
+    void ASTWriter::visit(NumberExprAST &node)
+    {
+        // most literals are small integers, a varint is shorter than a double
+        auto val = node.getVal();
+        if (val >= 0 && val < 9007199254740992.0 && val == (double) (uint64_t) val && !std::signbit(val)){
+            body += (char) tag_integer;
+            writeVarint((uint64_t) val);
+            return;
+        }
+        body += (char) tag_number;
+        char buffer[8];
+        llvm::support::endian::write64le(buffer, llvm::DoubleToBits(node.getVal()));
+        body.append(buffer, 8);
+    }
+
+    void ASTWriter::visit(VariableExprAST &node)
+    {
+        body += (char) tag_variable;
+        writeString(node.getName());
+    }
+
+    void ASTWriter::visit(UnaryExprAST &node)
+    {
+        body += (char) tag_unary;
+        writeVarint((unsigned char) node.getOpcode());
+        node.getExpr()->accept(*this);
+    }
+
+    void ASTWriter::visit(BinaryExprAST &node)
+    {
+        body += (char) tag_binary;
+        // characters of the builder may be signed
+        auto op = node.getOp();
+        writeVarint(op < 0 ? (unsigned char) op : op);
+        node.getLeftExpr()->accept(*this);
+        node.getRightExpr()->accept(*this);
+    }
+
+    void ASTWriter::visit(DeclarationExprAST &node)
+    {
+        body += (char) tag_declaration;
+        writeVarint(node.getVars().size());
+        for (std::size_t i = 0; i < node.getVars().size(); i++){
+            const auto &var = node.getVars()[i];
+            writeString(var.first);
+            body += (char) node.getType(i);
+            body += (char) (var.second != nullptr);
+            if (var.second){
+                var.second->accept(*this);
+            }
+        }
+        node.getBody()->accept(*this);
+    }
+
+    void ASTWriter::visit(CallExprAST &node)
+    {
+        body += (char) tag_call;
+        writeString(node.getCallee());
+        writeVarint(node.getArgs().size());
+        for (const auto &arg: node.getArgs()){
+            arg->accept(*this);
+        }
+    }
+
+    void ASTWriter::visit(IfExprAST &node)
+    {
+        body += (char) tag_if;
+        body += (char) node.haveElseMember();
+        node.getCond()->accept(*this);
+        node.getIfExpr()->accept(*this);
+        if (node.haveElseMember()){
+            node.getElseExpr()->accept(*this);
+        }
+    }
+
+    void ASTWriter::visit(ForExprAST &node)
+    {
+        body += (char) tag_for;
+        writeString(node.getVarName());
+        body += (char) node.getVarType();
+        node.getStart()->accept(*this);
+        node.getStep()->accept(*this);
+        node.getEnd()->accept(*this);
+        node.getBody()->accept(*this);
+    }
+
+    void ASTWriter::visit(PrototypeAST &node)
+    {
+        body += (char) tag_prototype;
+        writeString(node.getName());
+        writeVarint(node.getArgs().size());
+        for (std::size_t i = 0; i < node.getArgs().size(); i++){
+            writeString(node.getArgs()[i]);
+            body += (char) node.getArgType(i);
+        }
+        body += (char) node.getReturnType();
+        body += (char) node.isOperatorProto();
+        writeVarint(node.getPrecedence());
+    }
+
+    void ASTWriter::visit(FunctionAST &node)
+    {
+        body += (char) tag_function;
+        node.getProto()->accept(*this);
+        node.getBody()->accept(*this);
+    }
+
+    std::string ASTWriter::write(const std::vector<std::unique_ptr<ASTNode>> &nodes, uint64_t hash)
+    {
+        body.clear();
+        strings.clear();
+        stringsOrder.clear();
+
+        std::size_t count = 0;
+        for (const auto &node: nodes){
+            if (node){
+                node->accept(*this);
+                count++;
+            }
+        }
+        auto serializedNodes = std::move(body);
+
+        // header and string table
+        body.assign(AST_MAGIC, sizeof(AST_MAGIC));
+        writeVarint(AST_FORMAT_VERSION);
+        char buffer[8];
+        llvm::support::endian::write64le(buffer, hash);
+        body.append(buffer, 8);
+        writeVarint(stringsOrder.size());
+        for (const auto *str: stringsOrder){
+            writeVarint(str->size());
+            body += *str;
+        }
+        writeVarint(count);
+        body += serializedNodes;
+        return std::move(body);
+    }
+
+    std::nullptr_t ASTReader::logError(const char *str)
+    {
+        fprintf(stderr, "LogError: invalid serialized ast, %s\n", str);
+        return nullptr;
+    }
+
+    bool ASTReader::readVarint(uint64_t &value)
+    {
+        unsigned size = 0;
+        const char *error = nullptr;
+        auto begin = (const uint8_t *) data.data();
+        value = llvm::decodeULEB128(begin + pos, &size, begin + data.size(), &error);
+        if (error){
+            logError(error);
+            return false;
+        }
+        pos += size;
+        return true;
+    }
+
+    bool ASTReader::readString(std::string &str)
+    {
+        uint64_t index;
+        if (!readVarint(index)){
+            return false;
+        }
+        if (index >= strings.size()){
+            logError("string index out of range");
+            return false;
+        }
+        str = strings[index];
+        return true;
+    }
+
+    bool ASTReader::readType(ValueType &type)
+    {
+        if (pos >= data.size()){
+            logError("truncated type");
+            return false;
+        }
+        auto byte = (uint8_t) data[pos++];
+        if (byte > type_last){
+            logError("unknown type");
+            return false;
+        }
+        type = (ValueType) byte;
+        return true;
+    }
+
+    std::unique_ptr<ExprAST> ASTReader::readExpr()
+    {
+        if (pos >= data.size()){
+            return logError("truncated node");
+        }
+        // only the expressions the parser accepts, bounding the recursion on hostile input
+        if (depth >= MAX_NESTING_DEPTH){
+            return logError("nesting too deep");
+        }
+        // depth of the current node, restored on every return
+        struct DepthGuard{
+            int &depth;
+            explicit DepthGuard(int &counter): depth(++counter){}
+            ~DepthGuard(){depth--;}
+        } guard(depth);
+
+        auto tag = (uint8_t) data[pos++];
+        switch (tag) {
+            case tag_number: {
+                if (data.size() - pos < 8){
+                    return logError("truncated number");
+                }
+                auto bits = llvm::support::endian::read64le(data.data() + pos);
+                pos += 8;
+                return std::make_unique<NumberExprAST>(llvm::BitsToDouble(bits));
+            }
+            case tag_integer: {
+                uint64_t val;
+                if (!readVarint(val)){
+                    return nullptr;
+                }
+                return std::make_unique<NumberExprAST>((double) val);
+            }
+            case tag_variable: {
+                std::string name;
+                if (!readString(name)){
+                    return nullptr;
+                }
+                return std::make_unique<VariableExprAST>(std::move(name));
+            }
+            case tag_unary: {
+                uint64_t opcode;
+                if (!readVarint(opcode)){
+                    return nullptr;
+                }
+                if (opcode > 0xff || !isOperatorChar((char) opcode)){
+                    return logError("invalid unary operator");
+                }
+                auto expr = readExpr();
+                if (!expr){
+                    return nullptr;
+                }
+                return std::make_unique<UnaryExprAST>((char) opcode, std::move(expr));
+            }
+            case tag_binary: {
+                uint64_t op;
+                if (!readVarint(op)){
+                    return nullptr;
+                }
+                if (op < op_le ? !isOperatorChar((char) op) : op > op_last){
+                    return logError("invalid binary operator");
+                }
+                auto left = readExpr();
+                if (!left){
+                    return nullptr;
+                }
+                auto right = readExpr();
+                if (!right){
+                    return nullptr;
+                }
+                return std::make_unique<BinaryExprAST>(std::move(left), std::move(right), (int) op);
+            }
+            case tag_declaration: {
+                uint64_t count;
+                if (!readVarint(count)){
+                    return nullptr;
+                }
+                std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> vars;
+                std::vector<ValueType> types;
+                for (uint64_t i = 0; i < count; i++){
+                    std::string name;
+                    types.push_back(type_f64);
+                    if (!readString(name) || !readType(types.back())){
+                        return nullptr;
+                    }
+                    if (pos >= data.size()){
+                        return logError("truncated declaration");
+                    }
+                    std::unique_ptr<ExprAST> value;
+                    if (data[pos++]){
+                        value = readExpr();
+                        if (!value){
+                            return nullptr;
+                        }
+                    }
+                    vars.emplace_back(std::move(name), std::move(value));
+                }
+                auto body = readExpr();
+                if (!body){
+                    return nullptr;
+                }
+                return std::make_unique<DeclarationExprAST>(std::move(body), std::move(vars), std::move(types));
+            }
+            case tag_call: {
+                std::string callee;
+                uint64_t count;
+                if (!readString(callee) || !readVarint(count)){
+                    return nullptr;
+                }
+                std::vector<std::unique_ptr<ExprAST>> args;
+                for (uint64_t i = 0; i < count; i++){
+                    auto arg = readExpr();
+                    if (!arg){
+                        return nullptr;
+                    }
+                    args.push_back(std::move(arg));
+                }
+                return std::make_unique<CallExprAST>(std::move(callee), std::move(args));
+            }
+            case tag_if: {
+                if (pos >= data.size()){
+                    return logError("truncated if");
+                }
+                bool haveElse = data[pos++];
+                auto cond = readExpr();
+                if (!cond){
+                    return nullptr;
+                }
+                auto ifExpr = readExpr();
+                if (!ifExpr){
+                    return nullptr;
+                }
+                if (!haveElse){
+                    return std::make_unique<IfExprAST>(std::move(cond), std::move(ifExpr));
+                }
+                auto elseExpr = readExpr();
+                if (!elseExpr){
+                    return nullptr;
+                }
+                return std::make_unique<IfExprAST>(std::move(cond), std::move(ifExpr), std::move(elseExpr));
+            }
+            case tag_for: {
+                std::string varName;
+                ValueType varType;
+                if (!readString(varName) || !readType(varType)){
+                    return nullptr;
+                }
+                std::unique_ptr<ExprAST> exprs[4]; // start, step, end, body
+                for (auto &expr: exprs){
+                    expr = readExpr();
+                    if (!expr){
+                        return nullptr;
+                    }
+                }
+                return std::make_unique<ForExprAST>(std::move(exprs[0]), std::move(exprs[1]), std::move(exprs[2]),
+                                                    std::move(exprs[3]), std::move(varName), varType);
+            }
+            default:
+                return logError("unknown expression tag");
+        }
+    }
+
+    std::unique_ptr<PrototypeAST> ASTReader::readPrototype()
+    {
+        if (pos >= data.size() || data[pos++] != tag_prototype){
+            return logError("expected a prototype");
+        }
+        std::string name;
+        uint64_t count;
+        if (!readString(name) || !readVarint(count)){
+            return nullptr;
+        }
+        std::vector<std::string> args;
+        std::vector<ValueType> argTypes;
+        for (uint64_t i = 0; i < count; i++){
+            std::string arg;
+            argTypes.push_back(type_f64);
+            if (!readString(arg) || !readType(argTypes.back())){
+                return nullptr;
+            }
+            args.push_back(std::move(arg));
+        }
+        uint64_t precedence;
+        ValueType returnType;
+        if (!readType(returnType)){
+            return nullptr;
+        }
+        if (pos >= data.size()){
+            return logError("truncated prototype");
+        }
+        bool isOperator = data[pos++];
+        if (!readVarint(precedence)){
+            return nullptr;
+        }
+        // the rules of the parser: operators of a hostile file would be expanded or called with any argument count
+        ValueType conversion;
+        for (const auto &arg: args){
+            if (!isIdentifier(arg)){
+                return logError("invalid argument name");
+            }
+        }
+        if (!isOperator){
+            if (name == ANONIMOUS_EXPR ? !args.empty() : !isIdentifier(name) || conversionFromName(name, conversion)){
+                return logError("invalid function name");
+            }
+            if (precedence != 0){
+                return logError("precedence of a function");
+            }
+        } else if (name.rfind("binary", 0) == 0 && name.size() == 7){
+            if (!isOperatorChar(name.back()) || isBuiltinBinaryOp(name.back()) || args.size() != 2){
+                return logError("invalid binary operator");
+            }
+            if (precedence < 1 || precedence > MAX_PRECEDENCE){
+                return logError("invalid precedence");
+            }
+        } else if (name.rfind("unary", 0) == 0 && name.size() == 6){
+            if (!isOperatorChar(name.back()) || args.size() != 1 || precedence != 0){
+                return logError("invalid unary operator");
+            }
+        } else {
+            return logError("invalid operator name");
+        }
+        return std::make_unique<PrototypeAST>(std::move(name), std::move(args), isOperator, (int) precedence,
+                                              std::move(argTypes), returnType);
+    }
+
+    std::unique_ptr<FunctionAST> ASTReader::readFunction()
+    {
+        pos++; // tag
+        auto proto = readPrototype();
+        if (!proto){
+            return nullptr;
+        }
+        auto body = readExpr();
+        if (!body){
+            return nullptr;
+        }
+        return std::make_unique<FunctionAST>(std::move(proto), std::move(body));
+    }
+
+    bool ASTReader::read(std::vector<std::unique_ptr<ASTNode>> &nodes)
+    {
+        pos = 0;
+        if (!data.startswith(llvm::StringRef(AST_MAGIC, sizeof(AST_MAGIC)))){
+            logError("bad magic");
+            return false;
+        }
+        pos = sizeof(AST_MAGIC);
+        uint64_t version;
+        if (!readVarint(version)){
+            return false;
+        }
+        if (version != AST_FORMAT_VERSION){
+            logError("unsupported version");
+            return false;
+        }
+        if (data.size() - pos < 8){
+            logError("truncated header");
+            return false;
+        }
+        hash = llvm::support::endian::read64le(data.data() + pos);
+        pos += 8;
+
+        uint64_t count;
+        if (!readVarint(count)){
+            return false;
+        }
+        strings.clear();
+        for (uint64_t i = 0; i < count; i++){
+            uint64_t size;
+            if (!readVarint(size)){
+                return false;
+            }
+            if (data.size() - pos < size){
+                logError("truncated string table");
+                return false;
+            }
+            strings.emplace_back(data.substr(pos, size).str());
+            pos += size;
+        }
+
+        if (!readVarint(count)){
+            return false;
+        }
+        std::vector<std::unique_ptr<ASTNode>> res;
+        for (uint64_t i = 0; i < count; i++){
+            if (pos >= data.size()){
+                logError("truncated nodes");
+                return false;
+            }
+            std::unique_ptr<ASTNode> node;
+            if (data[pos] == tag_function){
+                node = readFunction();
+            } else {
+                node = readPrototype();
+            }
+            if (!node){
+                return false;
+            }
+            res.push_back(std::move(node));
+        }
+        if (pos != data.size()){
+            logError("trailing bytes");
+            return false;
+        }
+        nodes = std::move(res);
+        return true;
+    }
+}
@@ -0,0 +1,432 @@
+//
+// Interactive session and its snapshots
+//
+// snapshot   ::= magic version target precedences libraries prototypes inline objects
+// magic      ::= "KSNP"
+// version    ::= varint
+// target     ::= string{4}             llvm version, triple, cpu, features
+// precedences ::= varint (u8 varint)*  operator and precedence
+// libraries  ::= varint string* string shared code libraries in load order, binary ast of their prototypes
+// prototypes ::= string                binary ast of the prototypes, see serialize.h
+// inline     ::= string varint (string string)*
+//                                      binary ast of the operators expanded at their uses, then for each operator the
+//                                      binary ast of the definitions which expanded it
+// objects    ::= varint string*        objects in load order
+// string     ::= varint bytes
+//
+
+#include "session.h"
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+
+namespace ckalei{
+
+    static void writeVarint(std::string& out, uint64_t value)
+    {
+        uint8_t buffer[16];
+        auto size = llvm::encodeULEB128(value, buffer);
+        out.append((const char *) buffer, size);
+    }
+
+    static void writeString(std::string& out, llvm::StringRef str)
+    {
+        writeVarint(out, str.size());
+        out += str;
+    }
+
+    /// Cursor over the bytes of a snapshot
+    class SnapshotReader{
+
+    public:
+        explicit SnapshotReader(llvm::StringRef data): data(data){}
+
+        bool readVarint(uint64_t& value)
+        {
+            unsigned size = 0;
+            const char *error = nullptr;
+            auto begin = (const uint8_t *) data.data();
+            value = llvm::decodeULEB128(begin + pos, &size, begin + data.size(), &error);
+            pos += size;
+            return !error;
+        }
+
+        bool readString(llvm::StringRef& str)
+        {
+            uint64_t size;
+            if (!readVarint(size) || data.size() - pos < size){
+                return false;
+            }
+            str = data.substr(pos, size);
+            pos += size;
+            return true;
+        }
+
+        bool readByte(uint8_t& byte)
+        {
+            if (pos >= data.size()){
+                return false;
+            }
+            byte = data[pos++];
+            return true;
+        }
+
+        [[nodiscard]] bool atEnd() const {return pos == data.size();}
+
+    private:
+        llvm::StringRef data;
+        std::size_t pos = sizeof(SNAPSHOT_MAGIC);
+    };
+
+    /// Log an error about a snapshot and return nullptr
+    static std::nullptr_t logSnapshotError(const std::string& path, const char *str)
+    {
+        fprintf(stderr, "LogError: can not restore %s, %s\n", path.c_str(), str);
+        return nullptr;
+    }
+
+    /// Return a binary ast of prototypes
+    static std::string writePrototypes(const std::vector<PrototypeAST>& prototypes)
+    {
+        std::vector<std::unique_ptr<ASTNode>> nodes;
+        for (const auto &proto: prototypes){
+            nodes.push_back(std::make_unique<PrototypeAST>(proto));
+        }
+        return ASTWriter().write(nodes, 0);
+    }
+
+    /// Read a binary ast of prototypes. Return false if it holds anything else
+    static bool readPrototypes(llvm::StringRef data, std::vector<PrototypeAST>& prototypes)
+    {
+        std::vector<std::unique_ptr<ASTNode>> nodes;
+        if (!ASTReader(data).read(nodes)){
+            return false;
+        }
+        for (const auto &node: nodes){
+            auto *proto = dynamic_cast<PrototypeAST*>(node.get());
+            if (!proto){
+                return false;
+            }
+            prototypes.push_back(*proto);
+        }
+        return true;
+    }
+
+    /// Return a binary ast of copies of definitions
+    static std::string writeDefinitions(const std::vector<const FunctionAST*>& definitions)
+    {
+        std::vector<std::unique_ptr<ASTNode>> nodes;
+        for (const auto *definition: definitions){
+            nodes.push_back(std::make_unique<FunctionAST>(std::make_unique<PrototypeAST>(*definition->getProto()),
+                                                          CloneVisitor::clone(*definition->getBody())));
+        }
+        return ASTWriter().write(nodes, 0);
+    }
+
+    /// Read a binary ast of definitions. Return false if it holds anything else
+    static bool readDefinitions(llvm::StringRef data, std::vector<std::unique_ptr<FunctionAST>>& definitions)
+    {
+        std::vector<std::unique_ptr<ASTNode>> nodes;
+        if (!ASTReader(data).read(nodes)){
+            return false;
+        }
+        for (auto &node: nodes){
+            auto *definition = dynamic_cast<FunctionAST*>(node.get());
+            if (!definition){
+                return false;
+            }
+            node.release();
+            definitions.emplace_back(definition);
+        }
+        return true;
+    }
+
+    Session::Session(const JitOptions& options)
+    {
+        Program::initializeTargets();
+        compiler = std::make_unique<CodeGenVisitor>(options);
+        compiler->recordObjects();
+    }
+
+    Session::Session(std::unique_ptr<CodeGenVisitor> compiler): compiler(std::move(compiler)) {}
+
+    std::unique_ptr<Session> Session::clone()
+    {
+        auto session = std::unique_ptr<Session>(new Session(compiler->clone()));
+        session->precedences = precedences;
+        session->sharedLibraries = sharedLibraries;
+        session->sharedPrototypes = sharedPrototypes;
+        return session;
+    }
+
+    std::unique_ptr<std::vector<double>> Session::evaluate(const std::string &code)
+    {
+        auto parser = Parser(std::make_unique<Lexer>(code), precedences);
+        auto astData = parser.getAstNodes();
+        precedences = parser.getPrecedences();
+        return compiler->evaluate(astData);
+    }
+
+    bool Session::loadSharedCode(const std::string &code, const std::string &cacheDirectory)
+    {
+        auto parser = Parser(std::make_unique<Lexer>(code), precedences);
+        // the code is compiled alone: it declares the shared code loaded before it, which it can call
+        std::vector<std::unique_ptr<ASTNode>> astData;
+        for (const auto &proto: sharedPrototypes){
+            astData.push_back(std::make_unique<PrototypeAST>(proto));
+        }
+        for (auto &node: parser.getAstNodes()){
+            astData.push_back(std::move(node));
+        }
+        std::vector<PrototypeAST> prototypes;
+        for (auto i = sharedPrototypes.size(); i < astData.size(); i++){
+            const auto &node = astData[i];
+            if (!node){
+                return false;
+            }
+            if (auto *function = dynamic_cast<FunctionAST*>(node.get())){
+                if (function->getProto()->getName() == ANONIMOUS_EXPR){
+                    fprintf(stderr, "LogError: shared code can only hold definitions\n");
+                    return false;
+                }
+                prototypes.push_back(*function->getProto());
+            } else if (auto *proto = dynamic_cast<PrototypeAST*>(node.get())){
+                prototypes.push_back(*proto);
+            }
+        }
+
+        // the key covers the parsed code, which depends on the precedences, the libraries it links to and the target it
+        // is compiled for
+        auto key = ASTWriter().write(astData, 0);
+        for (const auto &library: sharedLibraries){
+            writeString(key, library);
+        }
+        for (const auto &description: targetDescription()){
+            writeString(key, description);
+        }
+        // snapshots and the libraries linking to this one record its path: it must not depend on the current directory
+        llvm::SmallString<128> path(cacheDirectory);
+        if (llvm::sys::fs::make_absolute(path)){
+            fprintf(stderr, "LogError: can not resolve %s\n", cacheDirectory.c_str());
+            return false;
+        }
+        llvm::sys::path::append(path, llvm::utohexstr(sourceHash(key)) + ".so");
+        auto library = path.str().str();
+
+        if (!llvm::sys::fs::exists(path)){
+            // concurrent processes may compile the same library: each one links its own file and renames it, so that
+            // a library is never loaded while being written
+            int fd;
+            llvm::SmallString<128> tmpPath;
+            if (llvm::sys::fs::createUniqueFile(library + ".tmp%%%%%%", fd, tmpPath)){
+                fprintf(stderr, "LogError: can not write %s\n", library.c_str());
+                return false;
+            }
+            llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+            auto program = Program(std::move(astData));
+            AotOptions options;
+            options.libraries = sharedLibraries;
+            if (!program.emitSharedLibrary(tmpPath.str().str(), options) || llvm::sys::fs::rename(tmpPath, path)){
+                llvm::sys::fs::remove(tmpPath);
+                fprintf(stderr, "LogError: can not write %s\n", library.c_str());
+                return false;
+            }
+        }
+        if (!compiler->loadLibrary(library)){
+            return false;
+        }
+        sharedLibraries.push_back(library);
+        for (const auto &proto: prototypes){
+            compiler->addPrototype(proto);
+            sharedPrototypes.push_back(proto);
+        }
+        precedences = parser.getPrecedences();
+        return true;
+    }
+
+    std::vector<std::string> Session::targetDescription() const
+    {
+        const auto &targetMachine = compiler->getTargetMachine();
+        return {LLVM_VERSION_STRING,
+                targetMachine.getTargetTriple().str(),
+                targetMachine.getTargetCPU().str(),
+                targetMachine.getTargetFeatureString().str()};
+    }
+
+    bool Session::saveSnapshot(const std::string &path)
+    {
+        std::string data(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        writeVarint(data, SNAPSHOT_FORMAT_VERSION);
+        for (const auto &description: targetDescription()){
+            writeString(data, description);
+        }
+
+        writeVarint(data, precedences.size());
+        for (const auto &[op, precedence]: precedences){
+            data += op;
+            writeVarint(data, precedence);
+        }
+
+        writeVarint(data, sharedLibraries.size());
+        for (const auto &library: sharedLibraries){
+            writeString(data, library);
+        }
+        writeString(data, writePrototypes(sharedPrototypes));
+
+        std::vector<PrototypeAST> prototypes;
+        for (const auto &proto: compiler->getPrototypes()){
+            if (proto.first != ANONIMOUS_EXPR){
+                prototypes.push_back(*proto.second);
+            }
+        }
+        writeString(data, writePrototypes(prototypes));
+
+        std::vector<const FunctionAST*> operators;
+        for (const auto &[name, definition]: compiler->getInlineOperators()){
+            if (definition){
+                operators.push_back(definition);
+            }
+        }
+        writeString(data, writeDefinitions(operators));
+        auto inlineCallers = compiler->getInlineCallers();
+        writeVarint(data, inlineCallers.size());
+        for (const auto &[op, callers]: inlineCallers){
+            std::vector<const FunctionAST*> definitions;
+            for (const auto &[name, definition]: callers){
+                definitions.push_back(definition);
+            }
+            writeString(data, op);
+            writeString(data, writeDefinitions(definitions));
+        }
+
+        auto objects = compiler->getRecordedObjects();
+        writeVarint(data, objects.size());
+        for (const auto &object: objects){
+            writeString(data, object.getBuffer());
+        }
+
+        std::error_code error;
+        llvm::raw_fd_ostream out(path, error, llvm::sys::fs::OF_None);
+        if (error){
+            fprintf(stderr, "LogError: can not open %s: %s\n", path.c_str(), error.message().c_str());
+            return false;
+        }
+        out << data;
+        return true;
+    }
+
+    std::unique_ptr<Session> Session::loadSnapshot(const std::string &path, const JitOptions& options)
+    {
+        auto buffer = llvm::MemoryBuffer::getFile(path, -1, false);
+        if (!buffer){
+            return logSnapshotError(path, buffer.getError().message().c_str());
+        }
+        auto data = (*buffer)->getBuffer();
+        if (!data.startswith(llvm::StringRef(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)))){
+            return logSnapshotError(path, "not a snapshot");
+        }
+        SnapshotReader reader(data);
+        uint64_t version;
+        if (!reader.readVarint(version) || version != SNAPSHOT_FORMAT_VERSION){
+            return logSnapshotError(path, "unsupported snapshot version");
+        }
+
+        auto session = std::make_unique<Session>(options);
+        for (const auto &expected: session->targetDescription()){
+            llvm::StringRef description;
+            if (!reader.readString(description)){
+                return logSnapshotError(path, "truncated snapshot");
+            }
+            if (description != expected){
+                return logSnapshotError(path, "compiled for another llvm version or target");
+            }
+        }
+
+        uint64_t count;
+        if (!reader.readVarint(count)){
+            return logSnapshotError(path, "truncated snapshot");
+        }
+        for (uint64_t i = 0; i < count; i++){
+            uint8_t op;
+            uint64_t precedence;
+            if (!reader.readByte(op) || !reader.readVarint(precedence)){
+                return logSnapshotError(path, "truncated snapshot");
+            }
+            session->precedences[(char) op] = (int) precedence;
+        }
+
+        if (!reader.readVarint(count)){
+            return logSnapshotError(path, "truncated snapshot");
+        }
+        for (uint64_t i = 0; i < count; i++){
+            llvm::StringRef library;
+            if (!reader.readString(library)){
+                return logSnapshotError(path, "truncated snapshot");
+            }
+            if (!session->compiler->loadLibrary(library.str())){
+                return logSnapshotError(path, "missing shared code");
+            }
+            session->sharedLibraries.push_back(library.str());
+        }
+        llvm::StringRef sharedPrototypes;
+        if (!reader.readString(sharedPrototypes) || !readPrototypes(sharedPrototypes, session->sharedPrototypes)){
+            return logSnapshotError(path, "invalid prototypes");
+        }
+
+        llvm::StringRef serializedPrototypes;
+        std::vector<PrototypeAST> prototypes;
+        if (!reader.readString(serializedPrototypes) || !readPrototypes(serializedPrototypes, prototypes)){
+            return logSnapshotError(path, "invalid prototypes");
+        }
+        for (const auto &proto: prototypes){
+            session->compiler->addPrototype(proto);
+        }
+
+        llvm::StringRef serializedOperators;
+        std::vector<std::unique_ptr<FunctionAST>> operators;
+        if (!reader.readString(serializedOperators) || !readDefinitions(serializedOperators, operators)){
+            return logSnapshotError(path, "invalid operators");
+        }
+        for (const auto &definition: operators){
+            session->compiler->addInlineOperator(*definition);
+        }
+        if (!reader.readVarint(count)){
+            return logSnapshotError(path, "truncated snapshot");
+        }
+        for (uint64_t i = 0; i < count; i++){
+            llvm::StringRef op, serializedCallers;
+            std::vector<std::unique_ptr<FunctionAST>> callers;
+            if (!reader.readString(op) || !reader.readString(serializedCallers)){
+                return logSnapshotError(path, "truncated snapshot");
+            }
+            if (!readDefinitions(serializedCallers, callers)){
+                return logSnapshotError(path, "invalid operators");
+            }
+            for (const auto &definition: callers){
+                session->compiler->addInlineCaller(op.str(), *definition);
+            }
+        }
+
+        if (!reader.readVarint(count)){
+            return logSnapshotError(path, "truncated snapshot");
+        }
+        std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects;
+        for (uint64_t i = 0; i < count; i++){
+            llvm::StringRef object;
+            if (!reader.readString(object)){
+                return logSnapshotError(path, "truncated snapshot");
+            }
+            // the jit needs aligned objects which outlive the file buffer
+            objects.push_back(llvm::MemoryBuffer::getMemBufferCopy(object, path));
+        }
+        if (!reader.atEnd()){
+            return logSnapshotError(path, "trailing bytes");
+        }
+        for (auto &object: objects){
+            session->compiler->addObject(std::move(object));
+        }
+        return session;
+    }
+}
@@ -0,0 +1,71 @@
+//
+// implementation for the assignment visitor
+//
+
+#include "visitor.h"
+
+
+namespace ckalei{
+
+    void AssignmentVisitor::visit(UnaryExprAST &node)
+    {
+        node.getExpr()->accept(*this);
+    }
+
+    void AssignmentVisitor::visit(BinaryExprAST &node)
+    {
+        if (node.getOp() == '='){
+            if (auto *variable = dynamic_cast<VariableExprAST*>(node.getLeftExpr().get())){
+                assigned.insert(variable->getName());
+            }
+        }
+        node.getLeftExpr()->accept(*this);
+        node.getRightExpr()->accept(*this);
+    }
+
+    void AssignmentVisitor::visit(DeclarationExprAST &node)
+    {
+        for (const auto &var: node.getVars()){
+            if (var.second){
+                var.second->accept(*this);
+            }
+        }
+        node.getBody()->accept(*this);
+    }
+
+    void AssignmentVisitor::visit(CallExprAST &node)
+    {
+        for (const auto &arg: node.getArgs()){
+            arg->accept(*this);
+        }
+    }
+
+    void AssignmentVisitor::visit(IfExprAST &node)
+    {
+        node.getCond()->accept(*this);
+        node.getIfExpr()->accept(*this);
+        if (node.haveElseMember()){
+            node.getElseExpr()->accept(*this);
+        }
+    }
+
+    void AssignmentVisitor::visit(ForExprAST &node)
+    {
+        node.getStart()->accept(*this);
+        node.getEnd()->accept(*this);
+        node.getStep()->accept(*this);
+        node.getBody()->accept(*this);
+    }
+
+    void AssignmentVisitor::visit(FunctionAST &node)
+    {
+        node.getBody()->accept(*this);
+    }
+
+    std::set<std::string> AssignmentVisitor::findAssigned(FunctionAST &function)
+    {
+        AssignmentVisitor visitor;
+        function.accept(visitor);
+        return std::move(visitor.assigned);
+    }
+}
@@ -0,0 +1,61 @@
+//
+// implementation for the C header visitor
+//
+
+#include <fmt/core.h>
+#include "visitor.h"
+
+
+namespace ckalei{
+
+    /// Return the C type of a value of type type
+    static const char *cType(ValueType type)
+    {
+        switch (type){
+            case type_i64:
+                return "int64_t";
+            case type_f32:
+                return "float";
+            default:
+                return "double";
+        }
+    }
+
+    void CHeaderVisitor::visit(FunctionAST &node)
+    {
+        const auto &proto = *node.getProto();
+        if (proto.isOperatorProto() || proto.getName() == "__anon_expr"){
+            return;
+        }
+        if (!declared.insert(proto.getName()).second){
+            return;
+        }
+        std::string args;
+        for (std::size_t i = 0; i < proto.getArgs().size(); i++){
+            args += fmt::format("{}{} {}", args.empty() ? "" : ", ", cType(proto.getArgType(i)), proto.getArgs()[i]);
+        }
+        declarations += fmt::format("{} {}({});\n", cType(proto.getReturnType()), proto.getName(),
+                                    args.empty() ? "void" : args);
+    }
+
+    std::string CHeaderVisitor::getStr() const
+    {
+        return fmt::format("// Generated by llvm_kaleidoscope, do not edit\n"
+                           "#ifndef {0}\n"
+                           "#define {0}\n"
+                           "\n"
+                           "#include <stdint.h>\n"
+                           "\n"
+                           "#ifdef __cplusplus\n"
+                           "extern \"C\" {{\n"
+                           "#endif\n"
+                           "\n"
+                           "{1}"
+                           "\n"
+                           "#ifdef __cplusplus\n"
+                           "}}\n"
+                           "#endif\n"
+                           "\n"
+                           "#endif // {0}\n", guard, declarations);
+    }
+}
@@ -0,0 +1,97 @@
+//
+// implementation for the clone visitor
+//
+
+#include "visitor.h"
+
+
+namespace ckalei{
+
+    void CloneVisitor::visit(NumberExprAST &node)
+    {
+        nodes++;
+        result = std::make_unique<NumberExprAST>(node.getVal());
+    }
+
+    void CloneVisitor::visit(VariableExprAST &node)
+    {
+        nodes++;
+        result = std::make_unique<VariableExprAST>(node.getName());
+    }
+
+    void CloneVisitor::visit(UnaryExprAST &node)
+    {
+        nodes++;
+        auto expr = copyOf(*node.getExpr());
+        result = std::make_unique<UnaryExprAST>(node.getOpcode(), std::move(expr));
+    }
+
+    void CloneVisitor::visit(BinaryExprAST &node)
+    {
+        nodes++;
+        auto left = copyOf(*node.getLeftExpr());
+        auto right = copyOf(*node.getRightExpr());
+        result = std::make_unique<BinaryExprAST>(std::move(left), std::move(right), node.getOp());
+    }
+
+    void CloneVisitor::visit(DeclarationExprAST &node)
+    {
+        nodes++;
+        std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> vars;
+        for (const auto &var: node.getVars()){
+            vars.emplace_back(var.first, var.second ? copyOf(*var.second) : nullptr);
+        }
+        auto body = copyOf(*node.getBody());
+        result = std::make_unique<DeclarationExprAST>(std::move(body), std::move(vars), node.getTypes());
+    }
+
+    void CloneVisitor::visit(CallExprAST &node)
+    {
+        nodes++;
+        std::vector<std::unique_ptr<ExprAST>> args;
+        for (const auto &arg: node.getArgs()){
+            args.push_back(copyOf(*arg));
+        }
+        result = std::make_unique<CallExprAST>(node.getCallee(), std::move(args));
+    }
+
+    void CloneVisitor::visit(IfExprAST &node)
+    {
+        nodes++;
+        auto cond = copyOf(*node.getCond());
+        auto ifExpr = copyOf(*node.getIfExpr());
+        if (!node.haveElseMember()){
+            result = std::make_unique<IfExprAST>(std::move(cond), std::move(ifExpr));
+            return;
+        }
+        auto elseExpr = copyOf(*node.getElseExpr());
+        result = std::make_unique<IfExprAST>(std::move(cond), std::move(ifExpr), std::move(elseExpr));
+    }
+
+    void CloneVisitor::visit(ForExprAST &node)
+    {
+        nodes++;
+        auto start = copyOf(*node.getStart());
+        auto step = copyOf(*node.getStep());
+        auto end = copyOf(*node.getEnd());
+        auto body = copyOf(*node.getBody());
+        result = std::make_unique<ForExprAST>(std::move(start), std::move(step), std::move(end), std::move(body),
+                                              node.getVarName(), node.getVarType());
+    }
+
+    std::unique_ptr<ExprAST> CloneVisitor::copyOf(ExprAST &expr)
+    {
+        expr.accept(*this);
+        return std::move(result);
+    }
+
+    std::unique_ptr<ExprAST> CloneVisitor::clone(ExprAST &expr, std::size_t *nodes)
+    {
+        CloneVisitor visitor;
+        auto copy = visitor.copyOf(expr);
+        if (nodes){
+            *nodes += visitor.nodes;
+        }
+        return copy;
+    }
+}
@@ -1,16 +1,123 @@
 //
 // Created by maxence on 28/03/2021.
 //
+#include <atomic>
+#include <cmath>
+#include <dlfcn.h>
+
 #include "visitor.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Scalar/Reassociate.h"
+#include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Mem2Reg.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
 
 namespace ckalei{
 
-    CodeGenVisitor::CodeGenVisitor(): jitTopLevel(false), debug(false)
+    /// Operations an arm of a conditional may cost to be evaluated unconditionally, see CostVisitor
+    static const int SELECT_ARM_BUDGET = 4;
+    /// Nodes of the largest operator body expanded at its uses
+    static const std::size_t INLINE_OPERATOR_NODES = 32;
+    /// Internal symbols renamed for the parts of split modules, in the process: their names are unique in the jits
+    static std::atomic<std::size_t> splitSymbolCount{0};
+
+    /// Return the llvm type of the values of type type
+    static llvm::Type *getValueType(llvm::LLVMContext &context, ValueType type)
+    {
+        switch (type){
+            case type_i64:
+                return llvm::Type::getInt64Ty(context);
+            case type_f32:
+                return llvm::Type::getFloatTy(context);
+            default:
+                return llvm::Type::getDoubleTy(context);
+        }
+    }
+
+    CodeLayer::CodeLayer(std::shared_ptr<llvm::orc::KaleidoscopeJIT> jit, std::shared_ptr<CodeLayer> base):
+            jit(std::move(jit)), base(std::move(base))
+    {
+        key = this->base ? this->jit->createLayer(this->base->key) : 0;
+    }
+
+    CodeLayer::~CodeLayer()
+    {
+        // the root layer goes with the jit
+        if (key){
+            jit->removeLayer(key);
+        }
+    }
+
+    PrototypeAST *CodeLayer::findPrototype(const std::string &name) const
+    {
+        for (auto *layer = this; layer; layer = layer->base.get()){
+            auto it = layer->prototypes.find(name);
+            if (it != layer->prototypes.end()){
+                return it->second.get();
+            }
+        }
+        return nullptr;
+    }
+
+    FunctionAST *CodeLayer::findInlineOperator(const std::string &name) const
+    {
+        for (auto *layer = this; layer; layer = layer->base.get()){
+            auto it = layer->inlineOperators.find(name);
+            if (it != layer->inlineOperators.end()){
+                return it->second.get();
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<std::shared_ptr<FunctionAST>> CodeLayer::findInlineCallers(const std::string &name) const
+    {
+        std::vector<std::shared_ptr<FunctionAST>> callers;
+        auto it = inlineCallers.find(name);
+        if (it != inlineCallers.end()){
+            for (const auto &[caller, definition]: it->second){
+                callers.push_back(definition);
+            }
+        }
+        return callers;
+    }
+
+    CodeGenVisitor::CodeGenVisitor(const JitOptions& options):
+            CodeGenVisitor(std::make_shared<CodeLayer>(std::make_shared<llvm::orc::KaleidoscopeJIT>(), nullptr),
+                           options)
+    {}
+
+    CodeGenVisitor::CodeGenVisitor(std::shared_ptr<CodeLayer> layer, const JitOptions& options):
+            layer(std::move(layer)), options(options),
+            context(std::make_unique<llvm::LLVMContext>()), builder(std::make_unique<llvm::IRBuilder<>>(*context)),
+            dataLayout(this->layer->jit->getTargetMachine().createDataLayout()), jitTopLevel(false), debug(false)
     {
-        jit = std::make_unique<llvm::orc::KaleidoscopeJIT>();
-        initModuleAndPassManager();
+        llvm::PassBuilder passBuilder;
+        passBuilder.registerModuleAnalyses(moduleAnalyses);
+        passBuilder.registerCGSCCAnalyses(cgsccAnalyses);
+        passBuilder.registerFunctionAnalyses(functionAnalyses);
+        passBuilder.registerLoopAnalyses(loopAnalyses);
+        passBuilder.crossRegisterProxies(loopAnalyses, functionAnalyses, cgsccAnalyses, moduleAnalyses);
+        initPassManager();
+        initModule();
+    }
+
+    std::unique_ptr<CodeGenVisitor> CodeGenVisitor::clone()
+    {
+        // pending definitions belong to this layer
+        flushModule();
+        return std::unique_ptr<CodeGenVisitor>(new CodeGenVisitor(std::make_shared<CodeLayer>(layer->jit, layer), options));
     }
 
     std::string CodeGenVisitor::ppformat() const
@@ -24,6 +131,29 @@ namespace ckalei{
         return str;
     }
 
+    std::string CodeGenVisitor::nativeFormat() const
+    {
+        if (!lastFunction){
+            return "Error during compilation\n";
+        }
+        if (lastFunction->isDeclaration()){
+            return "";
+        }
+        // Code generation rewrites the IR it runs on, so emit from a copy holding only lastFunction
+        llvm::ValueToValueMapTy vmap;
+        auto copy = llvm::CloneModule(*module, vmap, [this](const llvm::GlobalValue *gv){
+            return gv == lastFunction;
+        });
+        llvm::SmallString<0> str;
+        llvm::raw_svector_ostream stream(str);
+        llvm::legacy::PassManager asmPasses;
+        if (layer->jit->getTargetMachine().addPassesToEmitFile(asmPasses, stream, nullptr, llvm::CGFT_AssemblyFile)){
+            return "Target can not emit assembly\n";
+        }
+        asmPasses.run(*copy);
+        return std::string(str.str());
+    }
+
     void CodeGenVisitor::visit(NumberExprAST &node)
     {
         lastValue = llvm::ConstantFP::get(*context, llvm::APFloat(node.getVal()));
@@ -34,9 +164,15 @@ namespace ckalei{
         llvm::Value *varAddress = namedValues[node.getName()];
         if (!varAddress){
             lastValue = logErrorV("Unknown variable name");
+            return;
+        }
+        // load value from stack, unless the variable is bound to its value
+        lastValue = llvm::isa<llvm::AllocaInst>(varAddress) ?
+                builder->CreateLoad(varAddress, node.getName()) : varAddress;
+        // inferred integers are doubles for the expressions using them
+        if (integerBindings.count(varAddress)){
+            lastValue = builder->CreateSIToFP(lastValue, llvm::Type::getDoubleTy(*context), "tofp");
         }
-        // load value from stack
-        lastValue = builder->CreateLoad(varAddress, node.getName());
     }
 
     void CodeGenVisitor::visit(BinaryExprAST &node)
@@ -49,15 +185,29 @@ namespace ckalei{
                 lastValue = logErrorV("destination of '=' must be a variable");
                 return;
             }
+            auto *variable = llvm::dyn_cast_or_null<llvm::AllocaInst>(namedValues[lhse->getName()]);
+            if (!variable){lastValue = logErrorV("Unknown variable name"); return;}
+            // an inferred counter is only assigned integers, see IntegerVisitor
+            if (integerBindings.count(variable)){
+                auto rv = generateInteger(*node.getRightExpr());
+                builder->CreateStore(rv, variable);
+                lastValue = builder->CreateSIToFP(rv, llvm::Type::getDoubleTy(*context), "tofp");
+                return;
+            }
             // codegen the rhs
             node.getRightExpr()->accept(*this); if (!lastValue){ return;}
-            auto rv = lastValue;
-            llvm::Value *variable = namedValues[lhse->getName()];
-            if (!variable){lastValue = logErrorV("Unknown variable name"); return;}
+            auto rv = coerce(*node.getRightExpr(), lastValue, variable->getAllocatedType());
+            if (!rv){lastValue = nullptr; return;}
             builder->CreateStore(rv, variable);
             lastValue = rv;
             return;
         }
+        // comparisons and logic operators are booleans, converted to a double only when used as a value
+        if (isBooleanBinaryOp(node.getOp())){
+            auto cond = generateCondition(node);
+            lastValue = cond ? builder->CreateUIToFP(cond, llvm::Type::getDoubleTy(*context), "booltmp") : nullptr;
+            return;
+        }
         // Get left and right values
         node.getLeftExpr()->accept(*this);
         auto lv = lastValue;
@@ -68,76 +218,458 @@ namespace ckalei{
             return;
         }
 
-        switch (node.getOp()) {
-            case '+':
-                lastValue = builder->CreateFAdd(lv, rv, "addtmp");
-                return;
-            case '-':
-                lastValue = builder->CreateFSub(lv, rv, "subtmp");
-                return;
-            case '*':
-                lastValue = builder->CreateFMul(lv, rv, "multmp");
-                return;
-            case '/':
-                lastValue = builder->CreateFDiv(lv, rv, "divtmp");
+        if (isBuiltinBinaryOp(node.getOp())){
+            if (!unifyTypes(*node.getLeftExpr(), lv, *node.getRightExpr(), rv)){
+                lastValue = nullptr;
                 return;
+            }
+            bool isInteger = lv->getType()->isIntegerTy();
+            switch (node.getOp()) {
+                case '+':
+                    lastValue = isInteger ? builder->CreateAdd(lv, rv, "addtmp") : builder->CreateFAdd(lv, rv, "addtmp");
+                    return;
+                case '-':
+                    lastValue = isInteger ? builder->CreateSub(lv, rv, "subtmp") : builder->CreateFSub(lv, rv, "subtmp");
+                    return;
+                case '*':
+                    lastValue = isInteger ? builder->CreateMul(lv, rv, "multmp") : builder->CreateFMul(lv, rv, "multmp");
+                    return;
+                default:
+                    lastValue = isInteger ? generateIntegerDivision(lv, rv) : builder->CreateFDiv(lv, rv, "divtmp");
+                    return;
+            }
+        }
+        auto name = std::string("binary") + (char) node.getOp();
+        std::vector<llvm::Value *> ops = {lv, rv};
+        std::vector<ExprAST *> opExprs = {node.getLeftExpr().get(), node.getRightExpr().get()};
+        if (auto *definition = findInlineOperator(name)){
+            auto *signature = getFunctionType(*definition->getProto());
+            lastValue = coerceArguments(opExprs, ops, signature) ? expandOperator(*definition, ops) : nullptr;
+            return;
+        }
+        llvm::Function *f = getFunction(name);
+        if (!f){
+            lastValue = logErrorV("binary operator not found");
+            return;
+        }
+        if (!coerceArguments(opExprs, ops, f->getFunctionType())){
+            lastValue = nullptr;
+            return;
+        }
+        lastValue = builder->CreateCall(f, ops, "binop");
+    }
+
+    llvm::FunctionType *CodeGenVisitor::getFunctionType(const PrototypeAST &proto)
+    {
+        std::vector<llvm::Type *> argsTypes;
+        for (std::size_t i = 0; i < proto.getArgs().size(); i++){
+            argsTypes.push_back(getValueType(*context, proto.getArgType(i)));
+        }
+        return llvm::FunctionType::get(getValueType(*context, proto.getReturnType()), argsTypes, false);
+    }
+
+    bool CodeGenVisitor::matchesKnownSignature(const PrototypeAST &proto)
+    {
+        auto *known = layer->findPrototype(proto.getName());
+        if (known && getFunctionType(*known) != getFunctionType(proto)){
+            logErrorV("Function definition does not match its declaration");
+            return false;
+        }
+        return true;
+    }
+
+    llvm::Value *CodeGenVisitor::coerce(ExprAST &expr, llvm::Value *value, llvm::Type *type)
+    {
+        if (value->getType() == type){
+            return value;
+        }
+        auto *number = dynamic_cast<NumberExprAST*>(&expr);
+        if (!number){
+            return logErrorV("Type mismatch, convert explicitly with toi64(), tof32() or tof64()");
+        }
+        auto val = number->getVal();
+        if (!type->isIntegerTy()){
+            return llvm::ConstantFP::get(type, val);
+        }
+        if (val != std::trunc(val) || !(val >= -0x1p63 && val < 0x1p63)){
+            return logErrorV("Number literal is not an i64");
+        }
+        return llvm::ConstantInt::get(type, (int64_t) val, true);
+    }
+
+    bool CodeGenVisitor::unifyTypes(ExprAST &lhsExpr, llvm::Value *&lhs, ExprAST &rhsExpr, llvm::Value *&rhs)
+    {
+        if (lhs->getType() == rhs->getType()){
+            return true;
+        }
+        if (dynamic_cast<NumberExprAST*>(&rhsExpr)){
+            rhs = coerce(rhsExpr, rhs, lhs->getType());
+        } else {
+            lhs = coerce(lhsExpr, lhs, rhs->getType());
+        }
+        return lhs && rhs;
+    }
+
+    bool CodeGenVisitor::coerceArguments(const std::vector<ExprAST *> &exprs, std::vector<llvm::Value *> &args,
+                                         llvm::FunctionType *signature)
+    {
+        for (std::size_t i = 0; i < args.size(); i++){
+            args[i] = coerce(*exprs[i], args[i], signature->getParamType(i));
+            if (!args[i]){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    llvm::Value *CodeGenVisitor::convert(llvm::Value *value, llvm::Type *type)
+    {
+        if (value->getType() == type){
+            return value;
+        }
+        auto opcode = llvm::CastInst::getCastOpcode(value, true, type, true);
+        if (opcode != llvm::Instruction::FPToSI){
+            return builder->CreateCast(opcode, value, type, "convtmp");
+        }
+        // fptosi of NaN or of a value out of range is poison: saturate to the bounds instead, NaN gives 0. A select
+        // does not propagate the poison of the operand it does not choose
+        auto *converted = builder->CreateFPToSI(value, type, "convtmp");
+        auto *max = llvm::ConstantInt::get(type, INT64_MAX);
+        auto *min = llvm::ConstantInt::get(type, INT64_MIN);
+        auto *belowMax = builder->CreateFCmpOLT(value, llvm::ConstantFP::get(value->getType(), 0x1p63), "belowmax");
+        auto *aboveMin = builder->CreateFCmpOGE(value, llvm::ConstantFP::get(value->getType(), -0x1p63), "abovemin");
+        auto *saturated = builder->CreateSelect(aboveMin, builder->CreateSelect(belowMax, converted, max), min);
+        auto *isNan = builder->CreateFCmpUNO(value, value, "isnan");
+        return builder->CreateSelect(isNan, llvm::ConstantInt::get(type, 0), saturated, "convtmp");
+    }
+
+    llvm::Value *CodeGenVisitor::generateIntegerDivision(llvm::Value *lhs, llvm::Value *rhs)
+    {
+        auto *constant = llvm::dyn_cast<llvm::ConstantInt>(rhs);
+        if (constant && !constant->isZero() && !constant->isMinusOne()){
+            return builder->CreateSDiv(lhs, rhs, "divtmp");
+        }
+        // a zero divisor traps
+        auto *function = builder->GetInsertBlock()->getParent();
+        auto *trapBB = llvm::BasicBlock::Create(*context, "divzero", function);
+        auto *divBB = llvm::BasicBlock::Create(*context, "div", function);
+        auto *zero = llvm::ConstantInt::get(rhs->getType(), 0);
+        builder->CreateCondBr(builder->CreateICmpEQ(rhs, zero, "iszero"), trapBB, divBB);
+        builder->SetInsertPoint(trapBB);
+        builder->CreateIntrinsic(llvm::Intrinsic::trap, {}, {});
+        builder->CreateUnreachable();
+        builder->SetInsertPoint(divBB);
+        // INT64_MIN / -1 overflows, which sdiv leaves undefined: it wraps to INT64_MIN like the other operations
+        auto *minusOne = llvm::ConstantInt::get(rhs->getType(), -1, true);
+        auto *isMinusOne = builder->CreateICmpEQ(rhs, minusOne, "isminusone");
+        auto *divisor = builder->CreateSelect(isMinusOne, llvm::ConstantInt::get(rhs->getType(), 1), rhs);
+        auto *quotient = builder->CreateSDiv(lhs, divisor, "divtmp");
+        return builder->CreateSelect(isMinusOne, builder->CreateNeg(lhs, "negtmp"), quotient, "divtmp");
+    }
+
+    bool CodeGenVisitor::isSpeculatable(ExprAST &expr)
+    {
+        return CostVisitor::isSpeculatable(expr, SELECT_ARM_BUDGET, [this](const std::string &name){
+            auto it = namedValues.find(name);
+            // inferred integers are read as doubles
+            if (it == namedValues.end() || integerBindings.count(it->second)){
+                return false;
+            }
+            auto *alloca = llvm::dyn_cast<llvm::AllocaInst>(it->second);
+            return (alloca ? alloca->getAllocatedType() : it->second->getType())->isIntegerTy();
+        });
+    }
+
+    bool CodeGenVisitor::isIntegerOperand(ExprAST &expr)
+    {
+        if (auto *number = dynamic_cast<NumberExprAST*>(&expr)){
+            return number->getVal() == std::trunc(number->getVal()) && std::abs(number->getVal()) <= 0x1p53;
+        }
+        auto *variable = dynamic_cast<VariableExprAST*>(&expr);
+        if (!variable){
+            return false;
+        }
+        auto it = namedValues.find(variable->getName());
+        return it != namedValues.end() && integerBindings.count(it->second);
+    }
+
+    llvm::Value *CodeGenVisitor::generateInteger(ExprAST &expr)
+    {
+        if (auto *number = dynamic_cast<NumberExprAST*>(&expr)){
+            return llvm::ConstantInt::get(llvm::Type::getInt64Ty(*context), (int64_t) number->getVal(), true);
+        }
+        if (auto *variable = dynamic_cast<VariableExprAST*>(&expr)){
+            llvm::Value *varAddress = namedValues[variable->getName()];
+            return llvm::isa<llvm::AllocaInst>(varAddress) ?
+                    builder->CreateLoad(varAddress, variable->getName()) : varAddress;
+        }
+        auto *binary = static_cast<BinaryExprAST*>(&expr);
+        auto lv = generateInteger(*binary->getLeftExpr());
+        auto rv = generateInteger(*binary->getRightExpr());
+        return binary->getOp() == '+' ? builder->CreateAdd(lv, rv, "addtmp") : builder->CreateSub(lv, rv, "subtmp");
+    }
+
+    llvm::Value *CodeGenVisitor::generateCondition(ExprAST &expr)
+    {
+        auto *binary = dynamic_cast<BinaryExprAST*>(&expr);
+        if (!binary || !isBooleanBinaryOp(binary->getOp())){
+            expr.accept(*this);
+            if (!lastValue){return nullptr;}
+            auto zero = llvm::Constant::getNullValue(lastValue->getType());
+            return lastValue->getType()->isIntegerTy() ? builder->CreateICmpNE(lastValue, zero, "tobool") :
+                   builder->CreateFCmpONE(lastValue, zero, "tobool");
+        }
+        auto op = binary->getOp();
+        if (op == op_and || op == op_or){
+            return generateLogicalOp(*binary);
+        }
+        auto &lhsExpr = *binary->getLeftExpr();
+        auto &rhsExpr = *binary->getRightExpr();
+        llvm::Value *lv, *rv;
+        // inferred integers are compared as integers with each other and with integer literals
+        if (isIntegerOperand(lhsExpr) && isIntegerOperand(rhsExpr) &&
+            !(dynamic_cast<NumberExprAST*>(&lhsExpr) && dynamic_cast<NumberExprAST*>(&rhsExpr))){
+            lv = generateInteger(lhsExpr);
+            rv = generateInteger(rhsExpr);
+        } else {
+            lhsExpr.accept(*this);
+            lv = lastValue;
+            if (!lv){return nullptr;}
+            rhsExpr.accept(*this);
+            rv = lastValue;
+            if (!rv || !unifyTypes(lhsExpr, lv, rhsExpr, rv)){return nullptr;}
+        }
+        if (lv->getType()->isIntegerTy()){
+            switch (op){
+                case '<':
+                    return builder->CreateICmpSLT(lv, rv, "cmptmp");
+                case '>':
+                    return builder->CreateICmpSGT(lv, rv, "cmptmp");
+                case op_le:
+                    return builder->CreateICmpSLE(lv, rv, "cmptmp");
+                case op_ge:
+                    return builder->CreateICmpSGE(lv, rv, "cmptmp");
+                case op_eq:
+                    return builder->CreateICmpEQ(lv, rv, "cmptmp");
+                default:
+                    return builder->CreateICmpNE(lv, rv, "cmptmp");
+            }
+        }
+        // unordered like '<' always was: a comparison with nan is true, except ==
+        switch (op){
             case '<':
-                lv = builder->CreateFCmpULT(lv, rv, "cmptmp");
-                // convert bool 0/1 to double 0.0 or 1.0
-                lastValue = builder->CreateUIToFP(lv, llvm::Type::getDoubleTy(*context), "booltmp");
-                return;
+                return builder->CreateFCmpULT(lv, rv, "cmptmp");
+            case '>':
+                return builder->CreateFCmpUGT(lv, rv, "cmptmp");
+            case op_le:
+                return builder->CreateFCmpULE(lv, rv, "cmptmp");
+            case op_ge:
+                return builder->CreateFCmpUGE(lv, rv, "cmptmp");
+            case op_eq:
+                return builder->CreateFCmpOEQ(lv, rv, "cmptmp");
             default:
-                break;
+                return builder->CreateFCmpUNE(lv, rv, "cmptmp");
+        }
+    }
+
+    llvm::Value *CodeGenVisitor::generateLogicalOp(BinaryExprAST &node)
+    {
+        bool isAnd = node.getOp() == op_and;
+        auto lhs = generateCondition(*node.getLeftExpr());
+        if (!lhs){return nullptr;}
+        // a cheap right operand without side effects is evaluated unconditionally, without a branch
+        if (isSpeculatable(*node.getRightExpr())){
+            auto rhs = generateCondition(*node.getRightExpr());
+            if (!rhs){return nullptr;}
+            return isAnd ? builder->CreateAnd(lhs, rhs, "andtmp") : builder->CreateOr(lhs, rhs, "ortmp");
+        }
+
+        llvm::Function *function = builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock *lhsBB = builder->GetInsertBlock();
+        llvm::BasicBlock *rhsBB = llvm::BasicBlock::Create(*context, isAnd ? "andrhs" : "orrhs", function);
+        llvm::BasicBlock *mergeBB = llvm::BasicBlock::Create(*context, isAnd ? "andcont" : "orcont");
+        // the right operand is only evaluated if the left one does not decide the result
+        if (isAnd){
+            builder->CreateCondBr(lhs, rhsBB, mergeBB);
+        } else {
+            builder->CreateCondBr(lhs, mergeBB, rhsBB);
+        }
+        builder->SetInsertPoint(rhsBB);
+        auto rhs = generateCondition(*node.getRightExpr());
+        // the merge block is inserted even on error, to be erased with the function
+        function->getBasicBlockList().push_back(mergeBB);
+        if (!rhs){return nullptr;}
+        builder->CreateBr(mergeBB);
+        rhsBB = builder->GetInsertBlock();
+
+        builder->SetInsertPoint(mergeBB);
+        llvm::PHINode *phiN = builder->CreatePHI(llvm::Type::getInt1Ty(*context), 2, isAnd ? "andtmp" : "ortmp");
+        phiN->addIncoming(builder->getInt1(!isAnd), lhsBB);
+        phiN->addIncoming(rhs, rhsBB);
+        return phiN;
+    }
+
+    FunctionAST *CodeGenVisitor::findInlineOperator(const std::string &name)
+    {
+        if (!options.inlineOperators || expandedOperators.count(name)){
+            return nullptr;
+        }
+        return layer->findInlineOperator(name);
+    }
+
+    llvm::Value *CodeGenVisitor::expandOperator(FunctionAST &definition, const std::vector<llvm::Value *> &args)
+    {
+        const auto &name = definition.getProto()->getName();
+        const auto &params = definition.getProto()->getArgs();
+        // the body only sees its parameters, bound like the arguments of a call: each argument is evaluated once,
+        // before the body, and assigning a parameter does not change the caller variables
+        auto callerAssigned = std::move(assignedVariables);
+        auto callerIntegers = std::move(integerVariables);
+        assignedVariables = AssignmentVisitor::findAssigned(definition);
+        integerVariables = options.inferIntegers ? IntegerVisitor::findIntegers(definition) : IntegerVariables();
+        expandedOperators.insert(name);
+        operatorsExpanded.insert(name);
+        auto *function = builder->GetInsertBlock()->getParent();
+        std::vector<llvm::Value *> oldBindings;
+        for (std::size_t i = 0; i < params.size(); i++){
+            llvm::Value *value = args[i];
+            if (needsAlloca(params[i])){
+                auto alloca = createEntryBlockAlloca(function, params[i], value->getType());
+                builder->CreateStore(value, alloca);
+                value = alloca;
+            }
+            oldBindings.push_back(namedValues[params[i]]);
+            namedValues[params[i]] = value;
+        }
+
+        definition.getBody()->accept(*this);
+        if (lastValue){
+            lastValue = coerce(*definition.getBody(), lastValue,
+                               getValueType(*context, definition.getProto()->getReturnType()));
+        }
+
+        for (auto i = params.size(); i-- > 0;){
+            if (oldBindings[i]){
+                namedValues[params[i]] = oldBindings[i];
+            } else {
+                namedValues.erase(params[i]);
+            }
+        }
+        expandedOperators.erase(name);
+        assignedVariables = std::move(callerAssigned);
+        integerVariables = std::move(callerIntegers);
+        return lastValue;
+    }
+
+    void CodeGenVisitor::defineInlineOperator(const FunctionAST &definition, CodeLayer &target)
+    {
+        const auto &proto = *definition.getProto();
+        std::size_t nodes = 0;
+        auto body = CloneVisitor::clone(*definition.getBody(), &nodes);
+        // a redefinition too large to expand hides the previous definition from the uses compiled after it
+        auto &inlined = target.inlineOperators[proto.getName()];
+        inlined = nodes <= INLINE_OPERATOR_NODES ?
+                std::make_unique<FunctionAST>(std::make_unique<PrototypeAST>(proto), std::move(body)) : nullptr;
+    }
+
+    void CodeGenVisitor::recordInlineCallers(const FunctionAST &definition)
+    {
+        const auto &name = definition.getProto()->getName();
+        // the previous definition may have expanded other operators
+        for (auto &[op, callers]: layer->inlineCallers){
+            callers.erase(name);
+        }
+        if (operatorsExpanded.empty()){
+            return;
+        }
+        auto copy = std::make_shared<FunctionAST>(std::make_unique<PrototypeAST>(*definition.getProto()),
+                                                  CloneVisitor::clone(*definition.getBody()));
+        for (const auto &op: operatorsExpanded){
+            layer->inlineCallers[op][name] = copy;
         }
-        llvm::Function *f = getFunction(std::string("binary")+node.getOp());
-        assert(f && "binary operator not found");
-        llvm::Value *ops[2] = {lv, rv};
-        lastValue = builder->CreateCall(f, ops, "binop");
     }
 
     void CodeGenVisitor::visit(UnaryExprAST &node)
     {
         node.getExpr()->accept(*this);
         if (!lastValue){return;}
-        auto expr = lastValue;
-        llvm::Function *f = getFunction(std::string("unary")+node.getOpcode());
-        assert(f && "binary operator not found");
-        llvm::Value *ops[1] = {expr};
+        std::vector<llvm::Value *> ops = {lastValue};
+        std::vector<ExprAST *> opExprs = {node.getExpr().get()};
+        auto name = std::string("unary") + node.getOpcode();
+        if (auto *definition = findInlineOperator(name)){
+            auto *signature = getFunctionType(*definition->getProto());
+            lastValue = coerceArguments(opExprs, ops, signature) ? expandOperator(*definition, ops) : nullptr;
+            return;
+        }
+        llvm::Function *f = getFunction(name);
+        if (!f){
+            lastValue = logErrorV("unary operator not found");
+            return;
+        }
+        if (!coerceArguments(opExprs, ops, f->getFunctionType())){
+            lastValue = nullptr;
+            return;
+        }
         lastValue = builder->CreateCall(f, ops, "binop");
     }
 
     void CodeGenVisitor::visit(DeclarationExprAST &node)
     {
-        std::vector<llvm::AllocaInst *> oldBindings;
+        std::vector<llvm::Value *> oldBindings;
         auto *function = builder->GetInsertBlock()->getParent();
-        for (const auto &val: node.getVars()){
-            auto alloca = createEntryBlockAlloca(function, val.first);
-            llvm::Value* varVal = llvm::ConstantFP::get(*context, llvm::APFloat(0.0));
+        for (std::size_t i = 0; i < node.getVars().size(); i++){
+            const auto &val = node.getVars()[i];
+            bool isInteger = integerVariables.count({&node, i});
+            auto *type = isInteger ? llvm::Type::getInt64Ty(*context) : getValueType(*context, node.getType(i));
+            llvm::Value* varVal = llvm::Constant::getNullValue(type);
             if (val.second){
                 val.second->accept(*this);
                 if (!lastValue){return;}
-                varVal = lastValue;
+                varVal = coerce(*val.second, lastValue, type);
+                if (!varVal){lastValue = nullptr; return;}
+            }
+            if (needsAlloca(val.first)){
+                auto alloca = createEntryBlockAlloca(function, val.first, type);
+                builder->CreateStore(varVal, alloca);
+                varVal = alloca;
+                if (isInteger){
+                    integerBindings.insert(alloca);
+                }
             }
-            builder->CreateStore(varVal, alloca);
             oldBindings.push_back(namedValues[val.first]);
-            namedValues[val.first] = alloca;
+            namedValues[val.first] = varVal;
         }
         node.getBody()->accept(*this);
         if (!lastValue){return;}
-        auto bodyVal = lastValue;
 
-        namedValues.clear();
-        for (const auto &alloca: oldBindings){
-            if (alloca){
-                namedValues[alloca->getName()] = alloca;
+        // restore the shadowed variables, the others go out of scope. A name declared twice gets its first binding
+        // back last
+        const auto &vars = node.getVars();
+        for (auto i = vars.size(); i-- > 0;){
+            if (oldBindings[i]){
+                namedValues[vars[i].first] = oldBindings[i];
+            } else {
+                namedValues.erase(vars[i].first);
             }
         }
-
-        lastValue = bodyVal;
     }
 
     void CodeGenVisitor::visit(CallExprAST &node)
     {
+        // explicit conversions toi64(x), tof32(x) and tof64(x)
+        ValueType conversion;
+        if (conversionFromName(node.getCallee(), conversion)){
+            if (node.getArgs().size() != 1){
+                lastValue = logErrorV("A conversion takes one argument");
+                return;
+            }
+            node.getArgs()[0]->accept(*this);
+            if (lastValue){
+                lastValue = convert(lastValue, getValueType(*context, conversion));
+            }
+            return;
+        }
+
         llvm::Function *calleeF = getFunction(node.getCallee());
         if (!calleeF){
             lastValue = logErrorV("Function not found");
@@ -150,12 +682,18 @@ namespace ckalei{
         }
 
         std::vector<llvm::Value *> argsVals;
+        std::vector<ExprAST *> argsExprs;
         for (auto const& args: node.getArgs()){
             args->accept(*this);
             if (!lastValue){ // return in case of failure
                 return;
             }
             argsVals.push_back(lastValue);
+            argsExprs.push_back(args.get());
+        }
+        if (!coerceArguments(argsExprs, argsVals, calleeF->getFunctionType())){
+            lastValue = nullptr;
+            return;
         }
 
         lastValue = builder->CreateCall(calleeF, argsVals, "calltmp");
@@ -163,24 +701,44 @@ namespace ckalei{
 
     void CodeGenVisitor::visit(IfExprAST &node)
     {
-        node.getCond()->accept(*this);
-        if (! lastValue){return;}
-        auto condVal = lastValue;
-
-        // Convert condition to a bool
-        condVal = builder->CreateFCmpONE(condVal, llvm::ConstantFP::get(*context, llvm::APFloat(0.0)), "ifcond");
+        auto condVal = generateCondition(*node.getCond());
+        if (! condVal){lastValue = nullptr; return;}
 
+        // Cheap arms without side effects are both evaluated and selected: no branch to mispredict, and vectorizable
+        // code even without SimplifyCFG
+        if (node.haveElseMember() && isSpeculatable(*node.getIfExpr()) && isSpeculatable(*node.getElseExpr())){
+            node.getIfExpr()->accept(*this);
+            if (! lastValue){return;}
+            auto thenExpr = lastValue;
+            node.getElseExpr()->accept(*this);
+            if (! lastValue){return;}
+            auto elseExpr = lastValue;
+            if (!unifyTypes(*node.getIfExpr(), thenExpr, *node.getElseExpr(), elseExpr)){
+                lastValue = nullptr;
+                return;
+            }
+            lastValue = builder->CreateSelect(condVal, thenExpr, elseExpr, "iftmp");
+            return;
+        }
 
         llvm::Function *function = builder->GetInsertBlock()->getParent();
         llvm::BasicBlock *thenBB = llvm::BasicBlock::Create(*context, "then", function);
         llvm::BasicBlock *elseBB = llvm::BasicBlock::Create(*context, "else");
         llvm::BasicBlock *mergeBB = llvm::BasicBlock::Create(*context, "ifcont");
         builder->CreateCondBr(condVal, thenBB, elseBB);
+        // On error, blocks not inserted yet must still be owned by the function, which is erased with them
+        auto insertPendingBlocks = [&](){
+            for (auto *bb: {elseBB, mergeBB}){
+                if (!bb->getParent()){
+                    function->getBasicBlockList().push_back(bb);
+                }
+            }
+        };
 
         // Create then value
         builder->SetInsertPoint(thenBB);
         node.getIfExpr()->accept(*this);
-        if (! lastValue){return;}
+        if (! lastValue){insertPendingBlocks(); return;}
         auto thenExpr = lastValue;
         builder->CreateBr(mergeBB);
         thenBB = builder->GetInsertBlock();
@@ -191,18 +749,25 @@ namespace ckalei{
         llvm::Value *elseExpr = nullptr;
         if (node.haveElseMember()){
             node.getElseExpr()->accept(*this);
-            if (! lastValue){return;}
+            if (! lastValue){insertPendingBlocks(); return;}
             elseExpr = lastValue;
             builder->CreateBr(mergeBB);
         } else{
-            logErrorV("Omitted Else are not supported yet");
+            lastValue = logErrorV("Omitted Else are not supported yet");
+            insertPendingBlocks();
             return;
         }
         elseBB = builder->GetInsertBlock();
+        // a literal arm is a constant, converted without an instruction
+        if (!unifyTypes(*node.getIfExpr(), thenExpr, *node.getElseExpr(), elseExpr)){
+            lastValue = nullptr;
+            insertPendingBlocks();
+            return;
+        }
 
         function->getBasicBlockList().push_back(mergeBB);
         builder->SetInsertPoint(mergeBB);
-        llvm::PHINode *phiN = builder->CreatePHI(llvm::Type::getDoubleTy(*context), 2, "iftmp");
+        llvm::PHINode *phiN = builder->CreatePHI(thenExpr->getType(), 2, "iftmp");
 
         phiN->addIncoming(thenExpr, thenBB);
         phiN->addIncoming(elseExpr, elseBB);
@@ -212,40 +777,70 @@ namespace ckalei{
     void CodeGenVisitor::visit(ForExprAST &node)
     {
         llvm::Function *function = builder->GetInsertBlock()->getParent();
-        llvm::AllocaInst *alloca = createEntryBlockAlloca(function, node.getVarName());
+        bool inMemory = needsAlloca(node.getVarName());
+        bool isInteger = integerVariables.count({&node, 0});
+        auto *type = isInteger ? llvm::Type::getInt64Ty(*context) : getValueType(*context, node.getVarType());
+        llvm::AllocaInst *alloca = inMemory ? createEntryBlockAlloca(function, node.getVarName(), type) : nullptr;
+        if (alloca && isInteger){
+            integerBindings.insert(alloca);
+        }
 
         node.getStart()->accept(*this);
         if (! lastValue){return;}
-        auto startVal = lastValue;
-        builder->CreateStore(startVal, alloca);
+        auto startVal = coerce(*node.getStart(), lastValue, type);
+        if (! startVal){lastValue = nullptr; return;}
+        if (inMemory){
+            builder->CreateStore(startVal, alloca);
+        }
 
+        llvm::BasicBlock *preheaderBB = builder->GetInsertBlock();
         llvm::BasicBlock *loopBB = llvm::BasicBlock::Create(*context, "loop", function);
         builder->CreateBr(loopBB);
 
         // Create body
         builder->SetInsertPoint(loopBB);
-        llvm::AllocaInst* oldVar = namedValues[node.getVarName()]; // Save old var for restoration add set new var in context
-        namedValues[node.getVarName()] = alloca;
+        // without alloca the variable is a phi of the start value and of the next value of the previous iteration
+        llvm::PHINode *phiN = nullptr;
+        if (!inMemory){
+            phiN = builder->CreatePHI(type, 2, node.getVarName());
+            phiN->addIncoming(startVal, preheaderBB);
+            if (isInteger){
+                integerBindings.insert(phiN);
+            }
+        }
+        llvm::Value* oldVar = namedValues[node.getVarName()]; // Save old var for restoration add set new var in context
+        namedValues[node.getVarName()] = inMemory ? (llvm::Value *) alloca : phiN;
 
         node.getBody()->accept(*this); // create body code
         if (! lastValue){return;}
         node.getStep()->accept(*this); // compute step value
         if (! lastValue){return;}
-        auto stepVal = lastValue;
+        auto stepVal = coerce(*node.getStep(), lastValue, type);
+        if (! stepVal){lastValue = nullptr; return;}
 
-        /// Compute next value and store it
-        llvm::Value *variable = builder->CreateLoad(alloca);
-        llvm::Value *nextVar = builder->CreateFAdd(variable, stepVal, "nextvar");
-        builder->CreateStore(nextVar, alloca);
-        node.getEnd()->accept(*this); // compute end value
-        if (! lastValue){return;}
-        auto endCond = lastValue;
-        endCond = builder->CreateFCmpONE(endCond, llvm::ConstantFP::get(*context, llvm::APFloat(0.0)), "loopcond");
+        /// Compute next value and store it, the end condition sees it
+        llvm::Value *variable = inMemory ? (llvm::Value *) builder->CreateLoad(alloca) : phiN;
+        llvm::Value *nextVar = type->isIntegerTy() ? builder->CreateAdd(variable, stepVal, "nextvar") :
+                builder->CreateFAdd(variable, stepVal, "nextvar");
+        if (inMemory){
+            builder->CreateStore(nextVar, alloca);
+        } else {
+            namedValues[node.getVarName()] = nextVar;
+            if (isInteger){
+                integerBindings.insert(nextVar);
+            }
+        }
+        auto endCond = generateCondition(*node.getEnd()); // compute end value
+        if (! endCond){lastValue = nullptr; return;}
 
+        llvm::BasicBlock *loopEndBB = builder->GetInsertBlock();
         llvm::BasicBlock *afterBB = llvm::BasicBlock::Create(*context, "afterloop", function);
 
         builder->CreateCondBr(endCond, loopBB, afterBB);
         builder->SetInsertPoint(afterBB);
+        if (phiN){
+            phiN->addIncoming(nextVar, loopEndBB);
+        }
 
         // restore shadowed variable
         if (oldVar){
@@ -262,10 +857,7 @@ namespace ckalei{
             handleTopLevelExtern(node);
             return;
         }
-        std::vector<llvm::Type *> argsTypes(node.getArgs().size(), llvm::Type::getDoubleTy(*context));
-        auto signature = llvm::FunctionType::get(llvm::Type::getDoubleTy(*context), argsTypes, false);
-
-        auto func = llvm::Function::Create(signature,
+        auto func = llvm::Function::Create(getFunctionType(node),
                                               llvm::Function::ExternalLinkage,
                                               node.getName(),
                                               module.get());
@@ -289,8 +881,32 @@ namespace ckalei{
         }
 
         PrototypeAST& p = *(node.getProto());
-        functionProtos[node.getProto()->getName()] = std::make_unique<PrototypeAST>(p);
+        // Several top level expressions can share a module outside of the jit: rename the previous one
+        if (p.getName() == "__anon_expr"){
+            if (auto *previous = module->getFunction(p.getName())){
+                previous->setName(p.getName() + "." + std::to_string(anonymousExprCount++));
+            }
+        }
+        if (!matchesKnownSignature(p)){
+            lastFunction = nullptr;
+            return;
+        }
+        layer->prototypes[node.getProto()->getName()] = std::make_unique<PrototypeAST>(p);
         auto function = getFunction(p.getName());
+        if (!function){
+            lastFunction = nullptr;
+            return;
+        }
+        if (!function->empty()){
+            logErrorV("Function cannot be redefined");
+            lastFunction = nullptr;
+            return;
+        }
+        if (function->getFunctionType() != getFunctionType(p)){
+            logErrorV("Function definition does not match its declaration");
+            lastFunction = nullptr;
+            return;
+        }
 
         // Create the block for the function
         llvm::BasicBlock *bb = llvm::BasicBlock::Create(*context, "entry", function);
@@ -298,36 +914,61 @@ namespace ckalei{
 
         // Create a nue named value table containing functions args
         namedValues.clear();
+        operatorsExpanded.clear();
+        assignedVariables = AssignmentVisitor::findAssigned(node);
+        integerVariables = options.inferIntegers ? IntegerVisitor::findIntegers(node) : IntegerVariables();
+        integerBindings.clear();
         for (int i=0; i<function->arg_size(); i++){
-            auto alloca = createEntryBlockAlloca(function, node.getProto()->getArgs()[i]);
+            const auto &name = node.getProto()->getArgs()[i];
+            if (!needsAlloca(name)){
+                namedValues[name] = function->getArg(i);
+                continue;
+            }
+            auto alloca = createEntryBlockAlloca(function, name, function->getArg(i)->getType());
             builder->CreateStore(function->getArg(i), alloca);
-            namedValues[node.getProto()->getArgs()[i]] = alloca;
+            namedValues[name] = alloca;
         }
 
         node.getBody()->accept(*this);
         auto retVal =  lastValue;
+        // top level expressions are evaluated as doubles whatever their type
+        if (retVal && p.getName() == "__anon_expr"){
+            retVal = convert(retVal, function->getReturnType());
+        } else if (retVal){
+            retVal = coerce(*node.getBody(), retVal, function->getReturnType());
+        }
         if (retVal){
             builder->CreateRet(retVal);
-            llvm::verifyFunction(*function);
-            passManager->run(*function);
-            lastFunction = function;
-            return;
+            if (!llvm::verifyFunction(*function, &llvm::errs())){
+                passManager.run(*function, functionAnalyses);
+                // the function is freed with its module, its analyses must not be found by a later one
+                functionAnalyses.clear(*function, function->getName());
+                if (p.isOperatorProto()){
+                    defineInlineOperator(node, *layer);
+                }
+                lastFunction = function;
+                return;
+            }
+            logErrorV("Invalid function generated");
         }
+        // Remove the partially generated function
+        function->eraseFromParent();
         lastFunction = nullptr;
     }
 
     void CodeGenVisitor::handleTopLevelExpression(FunctionAST &node)
     {
         jitTopLevel = false;
+        // pending definitions get their own module: the one of the expression is freed once evaluated
+        flushModule();
         node.accept(*this);
         if (!lastFunction){
             return;
         }
 
-        jit->addModule(std::move(module));
-        initModuleAndPassManager();
+        auto keys = flushModule();
 
-        auto exprSymbol = jit->findSymbol("__anon_expr");
+        auto exprSymbol = layer->jit->findSymbol("__anon_expr", layer->key);
         assert(exprSymbol && "Function not found");
 
         auto adrr = exprSymbol.getAddress();
@@ -338,47 +979,297 @@ namespace ckalei{
         double (*fp)() = (double (*)()) (intptr_t) exprSymbol.getAddress().get();
         double val = fp();
         evaluationRes->push_back(val);
+        for (auto key: keys){
+            layer->jit->removeModule(key);
+        }
     }
 
     void CodeGenVisitor::handleTopLevelDefinition(FunctionAST &node)
     {
         jitTopLevel = false;
 
-        jit->addModule(std::move(module));
-        initModuleAndPassManager();
+        // start a new module once the current one is over budget, or to redefine one of its functions
+        auto *defined = module->getFunction(node.getProto()->getName());
+        if (pendingBytes >= options.moduleBudget || (defined && !defined->empty())){
+            flushModule();
+        }
 
         node.accept(*this);
+        if (!lastFunction){
+            return;
+        }
+        pendingBytes += estimateFunctionBytes(*lastFunction);
+        recordInlineCallers(node);
+
+        // the functions which expanded the previous definition of an operator are compiled again, their uses see the
+        // new one like the uses of the functions calling it
+        const auto &name = node.getProto()->getName();
+        if (node.getProto()->isOperatorProto()){
+            bool outermost = recompiledCallers.empty();
+            recompiledCallers.insert(name);
+            for (const auto &caller: layer->findInlineCallers(name)){
+                if (recompiledCallers.insert(caller->getProto()->getName()).second){
+                    handleTopLevelDefinition(*caller);
+                }
+            }
+            if (outermost){
+                recompiledCallers.clear();
+            }
+        }
     }
 
     void CodeGenVisitor::handleTopLevelExtern(PrototypeAST &node)
     {
         jitTopLevel = false;
+        if (!matchesKnownSignature(node)){
+            return;
+        }
         node.accept(*this);
-        functionProtos[node.getName()] = std::make_unique<PrototypeAST>(node);
+        layer->prototypes[node.getName()] = std::make_unique<PrototypeAST>(node);
     }
 
-    void CodeGenVisitor::initModuleAndPassManager()
+    void CodeGenVisitor::initModule()
     {
-        context = std::make_unique<llvm::LLVMContext>();
+        if (!options.reuseContext && module){
+            // objects of the previous context must not outlive it
+            builder.reset();
+            module.reset();
+            context = std::make_unique<llvm::LLVMContext>();
+            builder = std::make_unique<llvm::IRBuilder<>>(*context);
+            initPassManager();
+        }
         module = std::make_unique<llvm::Module>("jit", *context);
-        module->setDataLayout(jit->getTargetMachine().createDataLayout());
-        builder = std::make_unique<llvm::IRBuilder<>>(*context);
-        passManager = std::make_unique<llvm::legacy::FunctionPassManager>(module.get());
+        module->setDataLayout(dataLayout);
+    }
+
+    void CodeGenVisitor::initPassManager()
+    {
+        passManager = llvm::FunctionPassManager();
         if (!debug){
-            passManager->add(llvm::createPromoteMemoryToRegisterPass());
-            passManager->add(llvm::createInstructionCombiningPass());
-            passManager->add(llvm::createReassociatePass());
-            passManager->add(llvm::createGVNPass());
-            passManager->add(llvm::createCFGSimplificationPass());
+            passManager.addPass(llvm::PromotePass());
+            passManager.addPass(llvm::InstCombinePass());
+            passManager.addPass(llvm::ReassociatePass());
+            passManager.addPass(llvm::GVN());
+            passManager.addPass(llvm::SimplifyCFGPass());
         }
-        passManager->doInitialization();
     }
 
-    std::string CodeGenVisitor::getAssembly(const std::vector<std::unique_ptr<ASTNode>> &astData, bool debug)
+    std::vector<llvm::orc::VModuleKey> CodeGenVisitor::flushModule()
+    {
+        // declarations alone compile to nothing
+        if (std::all_of(module->begin(), module->end(), [](const llvm::Function &f){return f.isDeclaration();})){
+            return {};
+        }
+        auto irBytes = estimateModuleBytes(*module);
+        irPeakBytes = std::max(irPeakBytes, irBytes);
+        std::vector<llvm::orc::VModuleKey> keys;
+        if (options.threads > 1 && irBytes >= options.splitBytes){
+            keys = addSplitModule(std::move(module));
+        } else {
+            keys.push_back(layer->jit->addModule(std::move(module), layer->key));
+        }
+        initModule();
+        pendingBytes = 0;
+
+        auto &jitUsage = layer->jit->getMemoryUsage();
+        peakBytes = std::max(peakBytes, irBytes + jitUsage.CodeBytes + jitUsage.DataBytes);
+        return keys;
+    }
+
+    std::vector<llvm::orc::VModuleKey> CodeGenVisitor::addSplitModule(std::unique_ptr<llvm::Module> whole)
+    {
+        // Internal symbols called from another part are linked by the jit through exported names: they get names no
+        // program can define, with a '.', unique in the process so that they never resolve to other definitions
+        for (auto &value: whole->global_values()){
+            if (value.hasLocalLinkage()){
+                value.setName(("split." + llvm::Twine(splitSymbolCount++) + "." + value.getName()).str());
+            }
+        }
+
+        // The parts share the context of the module, which is not thread safe: as in the split code generation of
+        // lto, each part is written to bitcode and read back in a context of its own by its thread
+        std::vector<llvm::SmallString<0>> parts;
+        llvm::SplitModule(*whole, options.threads, [&parts](std::unique_ptr<llvm::Module> part){
+            // internal symbols called from another part are made hidden globals, the jit only links exported ones
+            for (auto &value: part->global_values()){
+                if (value.hasHiddenVisibility()){
+                    value.setVisibility(llvm::GlobalValue::DefaultVisibility);
+                }
+            }
+            parts.emplace_back();
+            llvm::raw_svector_ostream out(parts.back());
+            llvm::WriteBitcodeToFile(*part, out);
+        });
+        whole.reset();
+
+        std::vector<std::unique_ptr<llvm::TargetMachine>> targetMachines;
+        std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects(parts.size());
+        for (std::size_t i = 0; i < parts.size(); i++){
+            targetMachines.emplace_back(llvm::EngineBuilder().selectTarget());
+        }
+        {
+            llvm::ThreadPool pool(llvm::hardware_concurrency(parts.size()));
+            for (std::size_t i = 0; i < parts.size(); i++){
+                pool.async([&, i](){
+                    llvm::LLVMContext partContext;
+                    auto part = llvm::parseBitcodeFile(llvm::MemoryBufferRef(parts[i], "split"), partContext);
+                    if (!part){
+                        llvm::logAllUnhandledErrors(part.takeError(), llvm::errs(), "LogError: ");
+                        return;
+                    }
+                    auto object = llvm::orc::SimpleCompiler(*targetMachines[i])(**part);
+                    if (!object){
+                        llvm::logAllUnhandledErrors(object.takeError(), llvm::errs(), "LogError: ");
+                        return;
+                    }
+                    objects[i] = std::move(*object);
+                });
+            }
+            pool.wait();
+        }
+
+        // the parts call each other: they are linked once all are added
+        std::vector<llvm::orc::VModuleKey> keys;
+        for (auto &object: objects){
+            if (object){
+                keys.push_back(layer->jit->addObject(std::move(object), layer->key));
+            }
+        }
+        return keys;
+    }
+
+    void CodeGenVisitor::recordObjects()
+    {
+        layer->jit->setObjectRecording(true);
+    }
+
+    std::vector<llvm::MemoryBufferRef> CodeGenVisitor::getRecordedObjects()
+    {
+        flushModule();
+        return layer->jit->getRecordedObjects(layer->key);
+    }
+
+    void CodeGenVisitor::addObject(std::unique_ptr<llvm::MemoryBuffer> object)
+    {
+        flushModule();
+        layer->jit->addObject(std::move(object), layer->key);
+    }
+
+    bool CodeGenVisitor::loadLibrary(const std::string &path)
+    {
+        // a local handle keeps the symbols of the library out of the other sessions of the process
+        auto *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!handle){
+            fprintf(stderr, "LogError: can not load %s: %s\n", path.c_str(), dlerror());
+            return false;
+        }
+        layer->libraries.emplace_back(handle, dlclose);
+        layer->jit->addLibrary(llvm::sys::DynamicLibrary(handle), layer->key);
+        return true;
+    }
+
+    void CodeGenVisitor::addPrototype(const PrototypeAST &proto)
+    {
+        layer->prototypes[proto.getName()] = std::make_unique<PrototypeAST>(proto);
+    }
+
+    std::map<std::string, const PrototypeAST*> CodeGenVisitor::getPrototypes() const
     {
-        if (debug){
-            this->debug = true;
+        std::map<std::string, const PrototypeAST*> prototypes;
+        // the prototypes of a layer shadow the ones of its base layers
+        for (auto *current = layer.get(); current; current = current->base.get()){
+            for (const auto &[name, proto]: current->prototypes){
+                prototypes.emplace(name, proto.get());
+            }
         }
+        return prototypes;
+    }
+
+    std::map<std::string, const FunctionAST*> CodeGenVisitor::getInlineOperators() const
+    {
+        std::map<std::string, const FunctionAST*> operators;
+        for (auto *current = layer.get(); current; current = current->base.get()){
+            for (const auto &[name, definition]: current->inlineOperators){
+                operators.emplace(name, definition.get());
+            }
+        }
+        return operators;
+    }
+
+    std::map<std::string, std::map<std::string, const FunctionAST*>> CodeGenVisitor::getInlineCallers() const
+    {
+        std::map<std::string, std::map<std::string, const FunctionAST*>> callers;
+        std::set<std::string> redefined; // by the layers above the current one
+        for (auto *current = layer.get(); current; current = current->base.get()){
+            for (const auto &[op, definitions]: current->inlineCallers){
+                for (const auto &[name, definition]: definitions){
+                    if (!redefined.count(name)){
+                        callers[op].emplace(name, definition.get());
+                    }
+                }
+            }
+            for (const auto &[name, proto]: current->prototypes){
+                redefined.insert(name);
+            }
+        }
+        return callers;
+    }
+
+    void CodeGenVisitor::addInlineOperator(const FunctionAST &definition)
+    {
+        defineInlineOperator(definition, *layer);
+    }
+
+    void CodeGenVisitor::addInlineCaller(const std::string &op, const FunctionAST &definition)
+    {
+        layer->inlineCallers[op][definition.getProto()->getName()] = std::make_shared<FunctionAST>(
+                std::make_unique<PrototypeAST>(*definition.getProto()), CloneVisitor::clone(*definition.getBody()));
+    }
+
+    std::size_t CodeGenVisitor::estimateModuleBytes(const llvm::Module &module)
+    {
+        std::size_t bytes = sizeof(llvm::Module);
+        for (const auto &function: module){
+            bytes += estimateFunctionBytes(function);
+        }
+        return bytes;
+    }
+
+    std::size_t CodeGenVisitor::estimateFunctionBytes(const llvm::Function &function)
+    {
+        std::size_t bytes = sizeof(llvm::Function) + function.arg_size() * sizeof(llvm::Argument);
+        for (const auto &bb: function){
+            bytes += sizeof(llvm::BasicBlock);
+            for (const auto &inst: bb){
+                bytes += sizeof(llvm::Instruction) + inst.getNumOperands() * sizeof(llvm::Use);
+            }
+        }
+        return bytes;
+    }
+
+    MemoryStats CodeGenVisitor::getMemoryStats() const
+    {
+        auto &jitUsage = layer->jit->getMemoryUsage();
+        MemoryStats stats;
+        stats.irBytes = irPeakBytes;
+        stats.jitCodeBytes = jitUsage.CodeBytes;
+        stats.jitDataBytes = jitUsage.DataBytes;
+        stats.peakBytes = peakBytes;
+        return stats;
+    }
+
+    void CodeGenVisitor::setDebug(bool debugMode)
+    {
+        if (debug == debugMode){
+            return;
+        }
+        debug = debugMode;
+        initPassManager();
+    }
+
+    std::string CodeGenVisitor::getAssembly(const std::vector<std::unique_ptr<ASTNode>> &astData, bool debug)
+    {
+        setDebug(debug);
         std::string res;
         for (auto const& node: astData){
             if (node != nullptr){
@@ -386,31 +1277,296 @@ namespace ckalei{
                 res += ppformat();
             }
         }
-        this->debug = false;
         return res;
     }
 
-    std::unique_ptr<std::vector<double>> CodeGenVisitor::evaluate(const std::vector<std::unique_ptr<ASTNode>> &astData)
+    std::string CodeGenVisitor::getNativeAssembly(const std::vector<std::unique_ptr<ASTNode>> &astData, bool debug)
     {
-        evaluationRes = std::make_unique<std::vector<double>>();
+        setDebug(debug);
+        std::string res;
         for (auto const& node: astData){
             if (node != nullptr){
-                jitTopLevel = true;
                 node->accept(*this);
+                res += nativeFormat();
+            }
+        }
+        return res;
+    }
+
+    bool CodeGenVisitor::emitObject(const std::vector<std::unique_ptr<ASTNode>> &astData, const AotOptions &options,
+                                    const std::string &path)
+    {
+        auto targetMachine = createAotTargetMachine(options);
+        if (!targetMachine){
+            return false;
+        }
+        setDebug(options.optLevel == 0);
+        module->setDataLayout(targetMachine->createDataLayout());
+        module->setTargetTriple(targetMachine->getTargetTriple().str());
+
+        bool success = true;
+        std::vector<llvm::Function *> expressions;
+        for (auto const& node: astData){
+            if (node == nullptr){
+                continue;
+            }
+            node->accept(*this);
+            if (!lastFunction){
+                success = false;
+            } else if (lastFunction->getName().startswith("__anon_expr")){
+                lastFunction->setLinkage(llvm::Function::InternalLinkage);
+                expressions.push_back(lastFunction);
+            }
+        }
+        if (!success || (options.emitMain && !createMain(expressions))){
+            return false;
+        }
+
+        // Functions were optimised one by one, run the module passes (inlining, ipo) before emission
+        llvm::legacy::PassManager passes;
+        passes.add(llvm::createTargetTransformInfoWrapperPass(targetMachine->getTargetIRAnalysis()));
+        if (options.optLevel > 0){
+            llvm::PassManagerBuilder passBuilder;
+            passBuilder.OptLevel = options.optLevel;
+            passBuilder.Inliner = llvm::createFunctionInliningPass(options.optLevel, 0, false);
+            targetMachine->adjustPassManager(passBuilder);
+            passBuilder.populateModulePassManager(passes);
+        }
+
+        std::error_code error;
+        llvm::raw_fd_ostream out(path, error, llvm::sys::fs::OF_None);
+        if (error){
+            fprintf(stderr, "LogError: can not open %s: %s\n", path.c_str(), error.message().c_str());
+            return false;
+        }
+        if (targetMachine->addPassesToEmitFile(passes, out, nullptr, llvm::CGFT_ObjectFile)){
+            logErrorV("Target can not emit object files");
+            return false;
+        }
+        passes.run(*module);
+        out.flush();
+        return true;
+    }
+
+    bool CodeGenVisitor::createMain(const std::vector<llvm::Function *> &expressions)
+    {
+        if (module->getFunction("main")){
+            logErrorV("main is reserved in executables");
+            return false;
+        }
+        auto doubleTy = llvm::Type::getDoubleTy(*context);
+        auto intTy = llvm::Type::getInt32Ty(*context);
+        auto print = module->getOrInsertFunction(
+                "kal_print_result", llvm::FunctionType::get(llvm::Type::getVoidTy(*context), {doubleTy}, false));
+        auto flush = module->getOrInsertFunction("kal_flush", llvm::FunctionType::get(intTy, false));
+
+        auto main = llvm::Function::Create(llvm::FunctionType::get(intTy, false), llvm::Function::ExternalLinkage,
+                                           "main", module.get());
+        builder->SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", main));
+        for (auto *expression: expressions){
+            builder->CreateCall(print, {builder->CreateCall(expression)});
+        }
+        builder->CreateRet(builder->CreateCall(flush));
+        return !llvm::verifyFunction(*main, &llvm::errs());
+    }
+
+    std::unique_ptr<std::vector<double>> CodeGenVisitor::evaluate(const std::vector<std::unique_ptr<ASTNode>> &astData)
+    {
+        if (options.wholeProgram){
+            return evaluateWholeProgram(astData);
+        }
+        evaluationRes = std::make_unique<std::vector<double>>();
+        for (std::size_t i = 0; i < astData.size(); i++){
+            if (options.threads > 1){
+                // below a few definitions per thread the setup costs more than it saves
+                auto end = findParallelDefinitions(astData, i);
+                if (end - i >= 2 * options.threads){
+                    compileParallel(astData, i, end);
+                    i = end - 1;
+                    continue;
+                }
+            }
+            if (astData[i] != nullptr){
+                jitTopLevel = true;
+                astData[i]->accept(*this);
             }
         }
         return std::move(evaluationRes);
     }
 
+    std::size_t CodeGenVisitor::findParallelDefinitions(const std::vector<std::unique_ptr<ASTNode>> &astData,
+                                                        std::size_t begin)
+    {
+        std::set<std::string> defined;
+        auto end = begin;
+        for (; end < astData.size(); end++){
+            auto *function = dynamic_cast<FunctionAST*>(astData[end].get());
+            if (!function){
+                break;
+            }
+            const auto &name = function->getProto()->getName();
+            if (name == "__anon_expr" || layer->findPrototype(name) || !defined.insert(name).second){
+                break;
+            }
+        }
+        return end;
+    }
+
+    void CodeGenVisitor::compileParallel(const std::vector<std::unique_ptr<ASTNode>> &astData, std::size_t begin,
+                                         std::size_t end)
+    {
+        flushModule();
+        std::size_t chunks = options.threads;
+        std::vector<std::vector<FunctionAST*>> definitions(chunks);
+        std::vector<std::unique_ptr<CodeGenVisitor>> workers;
+        std::vector<std::unique_ptr<llvm::TargetMachine>> targetMachines;
+        std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects(chunks);
+        // Workers are created and destroyed on this thread, their layer over this one is only read while they run.
+        // Each one sees the definitions before its chunk, as a serial compilation would
+        for (std::size_t chunk = 0, i = begin; chunk < chunks; chunk++){
+            auto workerLayer = std::make_shared<CodeLayer>(layer->jit, layer);
+            for (auto j = begin; j < i; j++){
+                const auto &definition = static_cast<FunctionAST&>(*astData[j]);
+                const auto &proto = *definition.getProto();
+                workerLayer->prototypes[proto.getName()] = std::make_unique<PrototypeAST>(proto);
+                if (proto.isOperatorProto()){
+                    defineInlineOperator(definition, *workerLayer);
+                }
+            }
+            for (auto chunkEnd = begin + (end - begin) * (chunk + 1) / chunks; i < chunkEnd; i++){
+                definitions[chunk].push_back(static_cast<FunctionAST*>(astData[i].get()));
+            }
+            workers.push_back(std::unique_ptr<CodeGenVisitor>(new CodeGenVisitor(workerLayer, options)));
+            workers.back()->setDebug(debug);
+            targetMachines.emplace_back(llvm::EngineBuilder().selectTarget());
+        }
+
+        {
+            llvm::ThreadPool pool(llvm::hardware_concurrency(chunks));
+            for (std::size_t chunk = 0; chunk < chunks; chunk++){
+                pool.async([&, chunk](){
+                    objects[chunk] = workers[chunk]->compileDefinitions(definitions[chunk], *targetMachines[chunk]);
+                });
+            }
+            // the pool joins its threads when destroyed: none outlives the compilation
+            pool.wait();
+        }
+
+        // in source order, each object only calls the ones before it
+        for (std::size_t chunk = 0; chunk < chunks; chunk++){
+            if (objects[chunk]){
+                layer->jit->addObject(std::move(objects[chunk]), layer->key);
+            }
+            for (auto *definition: definitions[chunk]){
+                const auto &proto = *definition->getProto();
+                layer->prototypes[proto.getName()] = std::make_unique<PrototypeAST>(proto);
+            }
+            for (auto &[name, inlined]: workers[chunk]->layer->inlineOperators){
+                layer->inlineOperators[name] = std::move(inlined);
+            }
+            for (auto &[op, callers]: workers[chunk]->layer->inlineCallers){
+                for (auto &[caller, definition]: callers){
+                    layer->inlineCallers[op][caller] = std::move(definition);
+                }
+            }
+            irPeakBytes = std::max(irPeakBytes, workers[chunk]->irPeakBytes);
+        }
+        auto &jitUsage = layer->jit->getMemoryUsage();
+        peakBytes = std::max(peakBytes, irPeakBytes + jitUsage.CodeBytes + jitUsage.DataBytes);
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer> CodeGenVisitor::compileDefinitions(const std::vector<FunctionAST*> &definitions,
+                                                                           llvm::TargetMachine &targetMachine)
+    {
+        for (auto *definition: definitions){
+            definition->accept(*this);
+            if (lastFunction){
+                recordInlineCallers(*definition);
+            }
+        }
+        if (std::all_of(module->begin(), module->end(), [](const llvm::Function &f){return f.isDeclaration();})){
+            return nullptr;
+        }
+        irPeakBytes = estimateModuleBytes(*module);
+        auto object = llvm::orc::SimpleCompiler(targetMachine)(*module);
+        if (!object){
+            llvm::logAllUnhandledErrors(object.takeError(), llvm::errs(), "LogError: ");
+            return nullptr;
+        }
+        return std::move(*object);
+    }
+
+    std::unique_ptr<std::vector<double>> CodeGenVisitor::evaluateWholeProgram(
+            const std::vector<std::unique_ptr<ASTNode>> &astData)
+    {
+        // the definitions of previous evaluations stay in their own modules
+        flushModule();
+        std::vector<llvm::Function *> expressions;
+        for (auto const& node: astData){
+            if (node == nullptr){
+                continue;
+            }
+            if (auto *proto = dynamic_cast<PrototypeAST*>(node.get())){
+                handleTopLevelExtern(*proto);
+                continue;
+            }
+            node->accept(*this);
+            if (lastFunction && lastFunction->getName().startswith("__anon_expr")){
+                expressions.push_back(lastFunction);
+            }
+        }
+        // expressions are renamed as they share the module, their names are final once all are generated
+        std::vector<std::string> expressionNames;
+        std::set<std::string> preserved(options.entryPoints.begin(), options.entryPoints.end());
+        for (auto *expression: expressions){
+            expressionNames.push_back(expression->getName().str());
+            preserved.insert(expressionNames.back());
+        }
+
+        // internalised definitions may be inlined or removed: later evaluations can not call them
+        for (const auto &function: *module){
+            if (!function.isDeclaration() && !preserved.count(function.getName().str())){
+                layer->prototypes.erase(function.getName().str());
+            }
+        }
+        llvm::internalizeModule(*module, [&preserved](const llvm::GlobalValue &value){
+            return preserved.count(value.getName().str()) > 0;
+        });
+        auto &targetMachine = layer->jit->getTargetMachine();
+        llvm::legacy::PassManager passes;
+        passes.add(llvm::createTargetTransformInfoWrapperPass(targetMachine.getTargetIRAnalysis()));
+        llvm::PassManagerBuilder passBuilder;
+        passBuilder.OptLevel = 3;
+        passBuilder.Inliner = llvm::createFunctionInliningPass(3, 0, false);
+        targetMachine.adjustPassManager(passBuilder);
+        passBuilder.populateLTOPassManager(passes);
+        passes.run(*module);
+
+        auto res = std::make_unique<std::vector<double>>();
+        if (flushModule().empty()){
+            return res;
+        }
+        for (const auto &name: expressionNames){
+            auto symbol = layer->jit->findSymbol(name, layer->key);
+            auto address = symbol.getAddress();
+            if (!address){
+                llvm::handleAllErrors(address.takeError());
+                continue;
+            }
+            auto fp = (double (*)()) (intptr_t) *address;
+            res->push_back(fp());
+        }
+        return res;
+    }
+
     llvm::Function *CodeGenVisitor::getFunction(const std::string& name)
     {
         if (auto *f = module->getFunction(name)){
             return f;
         }
 
-        auto fi = functionProtos.find(name);
-        if (fi != functionProtos.end()){
-           fi->second->accept(*this);
+        if (auto *proto = layer->findPrototype(name)){
+            proto->accept(*this);
             return this->lastFunction;
         }
 
@@ -0,0 +1,91 @@
+//
+// implementation for the cost visitor
+//
+
+#include "visitor.h"
+
+
+namespace ckalei{
+
+    void CostVisitor::visit(VariableExprAST &node)
+    {
+        integer = isInteger && isInteger(node.getName());
+    }
+
+    void CostVisitor::visit(BinaryExprAST &node)
+    {
+        switch (node.getOp()){
+            case '+':
+            case '-':
+            case '*':
+            case '/':
+                break;
+            case '<':
+            case '>':
+            case op_le:
+            case op_ge:
+            case op_eq:
+            case op_ne:
+            case op_and:
+            case op_or:
+                cost += 1;
+                node.getLeftExpr()->accept(*this);
+                node.getRightExpr()->accept(*this);
+                integer = false;
+                return;
+            default:
+                // assignments store, user defined operators are calls
+                speculatable = false;
+                return;
+        }
+        // arithmetic has the type of its operands, a literal takes the type of the other one
+        node.getLeftExpr()->accept(*this);
+        auto leftInteger = integer;
+        node.getRightExpr()->accept(*this);
+        integer = integer || leftInteger;
+        if (node.getOp() == '/'){
+            // an integer division traps on a zero divisor
+            speculatable = speculatable && !integer;
+            cost += 4;
+        } else {
+            cost += 1;
+        }
+    }
+
+    void CostVisitor::visit(CallExprAST &node)
+    {
+        // conversions are single instructions, other calls may have side effects
+        ValueType type;
+        if (!conversionFromName(node.getCallee(), type) || node.getArgs().size() != 1){
+            speculatable = false;
+            return;
+        }
+        cost += 1;
+        node.getArgs()[0]->accept(*this);
+        integer = type == type_i64;
+    }
+
+    void CostVisitor::visit(IfExprAST &node)
+    {
+        // nested conditionals are only cheap as selects themselves
+        if (!node.haveElseMember()){
+            speculatable = false;
+            return;
+        }
+        cost += 1;
+        node.getCond()->accept(*this);
+        node.getIfExpr()->accept(*this);
+        auto thenInteger = integer;
+        node.getElseExpr()->accept(*this);
+        integer = integer || thenInteger;
+    }
+
+    bool CostVisitor::isSpeculatable(ExprAST &expr, int budget,
+                                     const std::function<bool(const std::string&)> &isInteger)
+    {
+        CostVisitor visitor;
+        visitor.isInteger = isInteger;
+        expr.accept(visitor);
+        return visitor.speculatable && visitor.cost <= budget;
+    }
+}
@@ -0,0 +1,58 @@
+//
+// implementation for the height visitor
+//
+
+#include "visitor.h"
+
+#include <algorithm>
+
+namespace ckalei{
+
+    void HeightVisitor::visit(UnaryExprAST &node)
+    {
+        height = 1 + measure(node.getExpr());
+    }
+
+    void HeightVisitor::visit(BinaryExprAST &node)
+    {
+        height = 1 + std::max(measure(node.getLeftExpr()), measure(node.getRightExpr()));
+    }
+
+    void HeightVisitor::visit(DeclarationExprAST &node)
+    {
+        int children = measure(node.getBody());
+        for (const auto &var: node.getVars()){
+            children = std::max(children, measure(var.second));
+        }
+        height = 1 + children;
+    }
+
+    void HeightVisitor::visit(CallExprAST &node)
+    {
+        int children = 0;
+        for (const auto &arg: node.getArgs()){
+            children = std::max(children, measure(arg));
+        }
+        height = 1 + children;
+    }
+
+    void HeightVisitor::visit(IfExprAST &node)
+    {
+        height = 1 + std::max({measure(node.getCond()), measure(node.getIfExpr()), measure(node.getElseExpr())});
+    }
+
+    void HeightVisitor::visit(ForExprAST &node)
+    {
+        height = 1 + std::max({measure(node.getStart()), measure(node.getEnd()), measure(node.getStep()),
+                               measure(node.getBody())});
+    }
+
+    int HeightVisitor::measure(const std::unique_ptr<ExprAST> &expr)
+    {
+        height = 0;
+        if (expr){
+            expr->accept(*this);
+        }
+        return height;
+    }
+}
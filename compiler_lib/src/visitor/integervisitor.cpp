@@ -0,0 +1,138 @@
+//
+// implementation for the integer visitor
+//
+
+#include "visitor.h"
+
+#include <cmath>
+
+
+namespace ckalei{
+
+    /// Magnitude of the integer literals a loop variable or a counter may start from or be set to
+    static const double START_LIMIT = 0x1p32;
+    /// Magnitude of the steps of loop variables and counters. Stepping by at most 16 from START_LIMIT, a variable
+    /// needs about 2^49 steps, days of computation, to leave the integers a double holds exactly
+    static const double STEP_LIMIT = 16;
+
+    /// Return true if expr is a number literal holding an integer of magnitude at most limit. -0 is not an integer
+    static bool isIntegerLiteral(const ExprAST &expr, double limit)
+    {
+        auto *number = dynamic_cast<const NumberExprAST*>(&expr);
+        if (!number){
+            return false;
+        }
+        auto val = number->getVal();
+        return val == std::trunc(val) && std::abs(val) <= limit && !(val == 0 && std::signbit(val));
+    }
+
+    /// Return true if expr is the variable name
+    static bool isVariable(const ExprAST &expr, const std::string &name)
+    {
+        auto *variable = dynamic_cast<const VariableExprAST*>(&expr);
+        return variable && variable->getName() == name;
+    }
+
+    bool IntegerVisitor::isCounterUpdate(const std::string &name, const ExprAST &value)
+    {
+        if (isIntegerLiteral(value, START_LIMIT)){
+            return true;
+        }
+        auto *binary = dynamic_cast<const BinaryExprAST*>(&value);
+        if (!binary || (binary->getOp() != '+' && binary->getOp() != '-')){
+            return false;
+        }
+        const auto &left = *binary->getLeftExpr();
+        const auto &right = *binary->getRightExpr();
+        return (isVariable(left, name) && isIntegerLiteral(right, STEP_LIMIT)) ||
+               (binary->getOp() == '+' && isIntegerLiteral(left, STEP_LIMIT) && isVariable(right, name));
+    }
+
+    void IntegerVisitor::visit(UnaryExprAST &node)
+    {
+        node.getExpr()->accept(*this);
+    }
+
+    void IntegerVisitor::visit(BinaryExprAST &node)
+    {
+        if (node.getOp() == '='){
+            if (auto *variable = dynamic_cast<VariableExprAST*>(node.getLeftExpr().get())){
+                assigned.insert(variable->getName());
+                if (!isCounterUpdate(variable->getName(), *node.getRightExpr())){
+                    nonCounters.insert(variable->getName());
+                }
+            }
+        }
+        node.getLeftExpr()->accept(*this);
+        node.getRightExpr()->accept(*this);
+    }
+
+    void IntegerVisitor::visit(DeclarationExprAST &node)
+    {
+        const auto &vars = node.getVars();
+        for (std::size_t i = 0; i < vars.size(); i++){
+            if (node.getType(i) == type_f64 && (!vars[i].second || isIntegerLiteral(*vars[i].second, START_LIMIT))){
+                counters.emplace_back(&node, i);
+            }
+            if (vars[i].second){
+                vars[i].second->accept(*this);
+            }
+        }
+        node.getBody()->accept(*this);
+    }
+
+    void IntegerVisitor::visit(CallExprAST &node)
+    {
+        for (const auto &arg: node.getArgs()){
+            arg->accept(*this);
+        }
+    }
+
+    void IntegerVisitor::visit(IfExprAST &node)
+    {
+        node.getCond()->accept(*this);
+        node.getIfExpr()->accept(*this);
+        if (node.haveElseMember()){
+            node.getElseExpr()->accept(*this);
+        }
+    }
+
+    void IntegerVisitor::visit(ForExprAST &node)
+    {
+        if (node.getVarType() == type_f64 && isIntegerLiteral(*node.getStart(), START_LIMIT) &&
+            isIntegerLiteral(*node.getStep(), STEP_LIMIT)){
+            loops.push_back(&node);
+        }
+        node.getStart()->accept(*this);
+        node.getEnd()->accept(*this);
+        node.getStep()->accept(*this);
+        node.getBody()->accept(*this);
+    }
+
+    void IntegerVisitor::visit(FunctionAST &node)
+    {
+        node.getBody()->accept(*this);
+    }
+
+    IntegerVariables IntegerVisitor::findIntegers(FunctionAST &function)
+    {
+        IntegerVisitor visitor;
+        function.accept(visitor);
+        IntegerVariables integers;
+        // a loop variable only changes by its step
+        for (const auto *loop: visitor.loops){
+            if (!visitor.assigned.count(loop->getVarName())){
+                integers.emplace(loop, 0);
+            }
+        }
+        // a counter only changes by small integer assignments. Never assigned variables are constants, left as they
+        // are
+        for (const auto &[declaration, i]: visitor.counters){
+            const auto &name = declaration->getVars()[i].first;
+            if (visitor.assigned.count(name) && !visitor.nonCounters.count(name)){
+                integers.emplace(declaration, i);
+            }
+        }
+        return integers;
+    }
+}
@@ -10,6 +10,12 @@
 
 namespace ckalei{
 
+    /// Return the annotation of a name of type type, empty for the default f64
+    static std::string typeSuffix(ValueType type)
+    {
+        return type == type_f64 ? "" : ":" + typeName(type);
+    }
+
     void PPrintorVisitor::visit(NumberExprAST &node)
     {
         str += fmt::format(getLinePrefix() + "NumberExpr({})\n", node.getVal());
@@ -36,7 +42,7 @@ namespace ckalei{
         str += getLinePrefix() + "BinaryExpr(\n";
         inc++;
         node.getLeftExpr()->accept(*this);
-        str += fmt::format(getLinePrefix() + "{}\n", node.getOp());
+        str += fmt::format(getLinePrefix() + "{}\n", operatorSpelling(node.getOp()));
         node.getRightExpr()->accept(*this);
         inc--;
         str += getLinePrefix() + ")\n";
@@ -46,8 +52,9 @@ namespace ckalei{
     {
         str += getLinePrefix() + "DeclarationExpr(\n";
         inc++;
-        for (const auto &pair : node.getVars()){
-            str += getLinePrefix() + pair.first + "\n"; // name
+        for (std::size_t i = 0; i < node.getVars().size(); i++){
+            const auto &pair = node.getVars()[i];
+            str += getLinePrefix() + pair.first + typeSuffix(node.getType(i)) + "\n"; // name
             if (pair.second){
                 inc++;
                 str += getLinePrefix() + "=\n";
@@ -83,11 +90,11 @@ namespace ckalei{
 
         inc++;
         auto const &args = node.getArgs();
-        for (auto const& argName: args){
-            str += getLinePrefix() +  argName + "\n";
+        for (std::size_t i = 0; i < args.size(); i++){
+            str += getLinePrefix() +  args[i] + typeSuffix(node.getArgType(i)) + "\n";
         }
         inc--;
-        str += getLinePrefix() + ")\n";
+        str += getLinePrefix() + ")" + typeSuffix(node.getReturnType()) + "\n";
     }
 
     void PPrintorVisitor::visit(IfExprAST &node)
@@ -107,7 +114,7 @@ namespace ckalei{
     {
         str += getLinePrefix() + "ForExpr(\n";
         inc++;
-        str += getLinePrefix() + node.getVarName() + "\n";
+        str += getLinePrefix() + node.getVarName() + typeSuffix(node.getVarType()) + "\n";
         node.getStart()->accept(*this);
         node.getStep()->accept(*this);
         node.getEnd()->accept(*this);
@@ -0,0 +1,98 @@
+//
+// implementation for the reachability visitor
+//
+
+#include "visitor.h"
+
+
+namespace ckalei{
+
+    void ReachabilityVisitor::visit(UnaryExprAST &node)
+    {
+        callees->insert(std::string("unary") + node.getOpcode());
+        node.getExpr()->accept(*this);
+    }
+
+    void ReachabilityVisitor::visit(BinaryExprAST &node)
+    {
+        // built in operators call no definition
+        if (!isBuiltinBinaryOp(node.getOp())){
+            callees->insert(std::string("binary") + (char) node.getOp());
+        }
+        node.getLeftExpr()->accept(*this);
+        node.getRightExpr()->accept(*this);
+    }
+
+    void ReachabilityVisitor::visit(DeclarationExprAST &node)
+    {
+        for (const auto &var: node.getVars()){
+            if (var.second){
+                var.second->accept(*this);
+            }
+        }
+        node.getBody()->accept(*this);
+    }
+
+    void ReachabilityVisitor::visit(CallExprAST &node)
+    {
+        callees->insert(node.getCallee());
+        for (const auto &arg: node.getArgs()){
+            arg->accept(*this);
+        }
+    }
+
+    void ReachabilityVisitor::visit(IfExprAST &node)
+    {
+        node.getCond()->accept(*this);
+        node.getIfExpr()->accept(*this);
+        if (node.haveElseMember()){
+            node.getElseExpr()->accept(*this);
+        }
+    }
+
+    void ReachabilityVisitor::visit(ForExprAST &node)
+    {
+        node.getStart()->accept(*this);
+        node.getEnd()->accept(*this);
+        node.getStep()->accept(*this);
+        node.getBody()->accept(*this);
+    }
+
+    void ReachabilityVisitor::visit(FunctionAST &node)
+    {
+        callees = &callGraph[node.getProto()->getName()];
+        node.getBody()->accept(*this);
+    }
+
+    std::vector<bool> ReachabilityVisitor::findReachable(const std::vector<std::unique_ptr<ASTNode>> &astData,
+                                                         const std::set<std::string> &exports)
+    {
+        ReachabilityVisitor visitor;
+        for (const auto &node: astData){
+            if (node){
+                node->accept(visitor);
+            }
+        }
+
+        // top level expressions all share a name, they are the roots with the exports
+        std::set<std::string> reached(exports);
+        reached.insert("__anon_expr");
+        std::vector<std::string> pending(reached.begin(), reached.end());
+        while (!pending.empty()){
+            auto name = std::move(pending.back());
+            pending.pop_back();
+            for (const auto &callee: visitor.callGraph[name]){
+                if (reached.insert(callee).second){
+                    pending.push_back(callee);
+                }
+            }
+        }
+
+        std::vector<bool> reachable;
+        for (const auto &node: astData){
+            auto *function = dynamic_cast<FunctionAST*>(node.get());
+            reachable.push_back(!function || reached.count(function->getProto()->getName()));
+        }
+        return reachable;
+    }
+}
@@ -1,10 +1,82 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cctype>
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Path.h"
 
 #include "program.h"
+#include "session.h"
 
-int main()
-{
-    auto code = R""""(
+namespace cl = llvm::cl;
+
+enum OutputMode{
+    evaluate,
+    ir,
+    assembly,
+    object,
+    shared,
+    executable,
+};
+
+static cl::opt<std::string> inputFile(cl::Positional, cl::desc("<input file>"), cl::init(""));
+
+static cl::opt<OutputMode> outputMode(
+        cl::desc("Output mode:"),
+        cl::init(evaluate),
+        cl::values(
+                clEnumValN(evaluate, "eval", "Evaluate top level expressions (default)"),
+                clEnumValN(ir, "ir", "Print the LLVM IR of each definition"),
+                clEnumValN(assembly, "asm", "Print the native assembly the jit produces for each definition"),
+                clEnumValN(object, "emit-obj", "Compile the definitions ahead of time into an object file and a C header"),
+                clEnumValN(shared, "emit-shared", "Compile the definitions ahead of time into a shared library and a C header"),
+                clEnumValN(executable, "emit-exe", "Compile the program into an executable printing its top level expressions")));
+
+static cl::opt<bool> noOpt("no-opt", cl::desc("Disable optimisation passes"), cl::init(false));
+
+static cl::opt<std::string> outputFile("o", cl::desc("Output file of -emit-obj, -emit-shared and -emit-exe"), cl::value_desc("file"));
+static cl::opt<std::string> headerFile("header", cl::desc("C header to write, defaults to the output file with a .h extension"),
+                                       cl::value_desc("file"));
+static cl::opt<unsigned> optLevel("O", cl::desc("Ahead of time optimisation level (0-3, default 2)"), cl::Prefix,
+                                  cl::init(2));
+static cl::opt<std::string> cpu("mcpu", cl::desc("Ahead of time target cpu, 'native' for the host (default generic)"),
+                                cl::init("generic"));
+
+static cl::opt<unsigned> moduleBudget("module-budget",
+                                      cl::desc("Estimated IR bytes of consecutive definitions the jit compiles "
+                                               "together (default 0, one module per definition)"),
+                                      cl::value_desc("bytes"), cl::init(0));
+
+static cl::opt<unsigned> jitThreads("jit-threads",
+                                    cl::desc("Threads compiling consecutive definitions in parallel (default 1)"),
+                                    cl::init(1));
+static cl::opt<bool> wholeProgram("whole-program",
+                                  cl::desc("Optimise the evaluated program as a whole, like link time optimisation"),
+                                  cl::init(false));
+
+static cl::opt<bool> prune("prune", cl::desc("Skip the definitions no top level expression or export reaches"),
+                           cl::init(false));
+static cl::list<std::string> exports("export", cl::desc("Definitions kept by -prune"), cl::CommaSeparated,
+                                     cl::value_desc("name,..."));
+
+static cl::opt<std::string> astCache("ast-cache", cl::desc("Directory caching the parsed ast of sources"),
+                                     cl::value_desc("directory"));
+static cl::opt<std::string> saveAst("save-ast", cl::desc("Write the binary ast of the program, loadable as input file"),
+                                    cl::value_desc("file.kast"));
+
+static cl::opt<std::string> loadSnapshot("load-snapshot", cl::desc("Evaluate in a session restored from a snapshot"),
+                                         cl::value_desc("file"));
+static cl::opt<std::string> saveSnapshot("save-snapshot", cl::desc("Save the session to a snapshot after evaluation"),
+                                         cl::value_desc("file"));
+
+static cl::list<std::string> sharedCode("shared-code",
+                                        cl::desc("Definitions loaded from the shared code cache before evaluation"),
+                                        cl::value_desc("file"));
+static cl::opt<std::string> codeCache("code-cache", cl::desc("Directory of the shared code cache (default .)"),
+                                      cl::value_desc("directory"), cl::init("."));
+
+static const char *exampleCode = R""""(
         def binary : 1 (x y) y;
         def fib(x)
             var a = 1, b = 1, c in
@@ -18,8 +90,144 @@ int main()
         fib(5)
         fib(10)
     )"""";
-    auto program = ckalei::Program(code);
-    auto res = *program.evaluate();
+
+/// Return the jit options given on the command line
+ckalei::JitOptions jitOptions()
+{
+    ckalei::JitOptions options;
+    options.moduleBudget = moduleBudget;
+    options.wholeProgram = wholeProgram;
+    options.threads = std::max(1u, (unsigned) jitThreads);
+    return options;
+}
+
+/// Compile program ahead of time to output, with its C header for libraries. Return the exit code
+int emitAot(const ckalei::Program &program, OutputMode mode)
+{
+    std::string output = outputFile;
+    if (output.empty()){
+        output = mode == object ? "a.o" : mode == shared ? "a.so" : "a.out";
+    }
+    ckalei::AotOptions options;
+    options.optLevel = noOpt ? 0 : optLevel;
+    options.cpu = cpu;
+    if (mode == executable){
+        return program.emitExecutable(output, options) ? 0 : 1;
+    }
+    bool success = mode == object ? program.emitObject(output, options) : program.emitSharedLibrary(output, options);
+    if (!success){
+        return 1;
+    }
+
+    llvm::SmallString<128> header(headerFile.empty() ? output : headerFile);
+    if (headerFile.empty()){
+        llvm::sys::path::replace_extension(header, "h");
+    }
+    // include guard from the header file name
+    std::string guard;
+    for (auto c: llvm::sys::path::filename(header)){
+        guard += std::isalnum((unsigned char) c) ? (char) std::toupper((unsigned char) c) : '_';
+    }
+    std::ofstream headerStream(header.str().str());
+    if (!headerStream){
+        std::cerr << "Can not open " << header.str().str() << "\n";
+        return 1;
+    }
+    headerStream << program.getCHeader(guard);
+    return 0;
+}
+
+/// Evaluate code in a session restored from or saved to a snapshot, after loading the shared code. Return the exit
+/// code
+int evaluateInSession(const std::string &code)
+{
+    auto session = loadSnapshot.empty() ? std::make_unique<ckalei::Session>(jitOptions())
+                                        : ckalei::Session::loadSnapshot(loadSnapshot, jitOptions());
+    if (!session){
+        return 1;
+    }
+    for (const auto &file: sharedCode){
+        std::ifstream stream(file);
+        if (!stream){
+            std::cerr << "Can not open " << file << "\n";
+            return 1;
+        }
+        std::stringstream buffer;
+        buffer << stream.rdbuf();
+        if (!session->loadSharedCode(buffer.str(), codeCache)){
+            return 1;
+        }
+    }
+    auto res = session->evaluate(code);
+    for (const auto &v: *res){
+        std::cout << v << "\n";
+    }
+    if (!saveSnapshot.empty() && !session->saveSnapshot(saveSnapshot)){
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, argv, "Kaleidoscope jit compiler\n");
+    if (optLevel > ckalei::MAX_OPT_LEVEL){
+        std::cerr << "-O takes a level between 0 and " << ckalei::MAX_OPT_LEVEL << "\n";
+        return 1;
+    }
+
+    std::unique_ptr<ckalei::Program> programPtr;
+    std::string code = exampleCode;
+    if (llvm::StringRef(inputFile).endswith(".kast")){
+        programPtr = ckalei::Program::loadAst(inputFile);
+        if (!programPtr){
+            return 1;
+        }
+    } else if (!inputFile.empty()){
+        std::ifstream file(inputFile);
+        if (!file){
+            std::cerr << "Can not open " << inputFile << "\n";
+            return 1;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        code = buffer.str();
+    }
+
+    if (outputMode == evaluate && (!loadSnapshot.empty() || !saveSnapshot.empty() || !sharedCode.empty())){
+        if (programPtr){
+            std::cerr << "Sessions evaluate source files only\n";
+            return 1;
+        }
+        // a restored session only evaluates what the input adds
+        return evaluateInSession(inputFile.empty() && !loadSnapshot.empty() ? "" : code);
+    }
+    if (!programPtr){
+        programPtr = astCache.empty() ? std::make_unique<ckalei::Program>(code)
+                                      : ckalei::Program::loadCached(code, astCache);
+    }
+    auto &program = *programPtr;
+    if (!saveAst.empty() && !program.saveAst(saveAst)){
+        return 1;
+    }
+    if (prune){
+        program.pruneUnreachable(std::set<std::string>(exports.begin(), exports.end()));
+    }
+    switch (outputMode) {
+        case ir:
+            std::cout << program.getAssembly(noOpt);
+            return 0;
+        case assembly:
+            std::cout << program.getNativeAssembly(noOpt);
+            return 0;
+        case object:
+        case shared:
+        case executable:
+            return emitAot(program, outputMode);
+        case evaluate:
+            break;
+    }
+    auto res = *program.evaluate(jitOptions());
     for (const auto &v :res){
         std::cout << v << "\n";
     }
@@ -0,0 +1,55 @@
+//
+// Microbenchmark of the per definition overhead of the jit: small definitions are evaluated one module each, so the
+// time per definition is dominated by the setup of the module and its compilation. Each mode is measured with the
+// context, builder and pass pipeline reused across modules, and created again for each module.
+//
+//   ./benchDefinitions [definitions] [repetitions]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "session.h"
+
+/// Return the best time of repetitions evaluations of code in a new session, in microseconds
+static double bestTime(const std::string &code, int repetitions, const ckalei::JitOptions &options)
+{
+    double best = 0;
+    for (int i = 0; i < repetitions; i++){
+        auto session = ckalei::Session(options);
+        auto start = std::chrono::steady_clock::now();
+        session.evaluate(code);
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        best = i ? std::min(best, elapsed.count()) : elapsed.count();
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    int definitions = argc > 1 ? std::atoi(argv[1]) : 500;
+    int repetitions = argc > 2 ? std::atoi(argv[2]) : 5;
+
+    std::string code;
+    for (int i = 0; i < definitions; i++){
+        code += "def f" + std::to_string(i) + "(x) x * " + std::to_string(i) + " + 1;\n";
+    }
+
+    printf("%d definitions, best of %d, in us per definition\n", definitions, repetitions);
+    printf("%-28s %10s %10s\n", "", "reused", "recreated");
+    for (std::size_t budget: {std::size_t(0), std::size_t(1 << 16)}){
+        double times[2];
+        for (int reuse = 1; reuse >= 0; reuse--){
+            ckalei::JitOptions options;
+            options.moduleBudget = budget;
+            options.reuseContext = reuse;
+            times[1 - reuse] = bestTime(code, repetitions, options) / definitions;
+        }
+        printf("%-28s %10.1f %10.1f\n", budget ? "module budget of 64 KiB" : "one module per definition",
+               times[0], times[1]);
+    }
+    return 0;
+}
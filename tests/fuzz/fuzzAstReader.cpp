@@ -0,0 +1,20 @@
+//
+// libFuzzer harness: read the input as a binary ast and compile it. The generated code is not run, a valid program
+// may loop forever.
+//
+
+#include <cstdint>
+
+#include "program.h"
+#include "serialize.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    auto reader = ckalei::ASTReader(llvm::StringRef((const char *) data, size));
+    std::vector<std::unique_ptr<ckalei::ASTNode>> nodes;
+    if (reader.read(nodes)){
+        auto program = ckalei::Program(std::move(nodes));
+        auto assembly = program.getAssembly();
+    }
+    return 0;
+}
@@ -0,0 +1,16 @@
+//
+// libFuzzer harness: tokenize the input
+//
+
+#include <cstdint>
+#include <string>
+
+#include "lexer.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    auto lexer = ckalei::Lexer(std::string((const char *) data, size));
+    while (lexer.getTok() != ckalei::tok_eof){
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+//
+// libFuzzer harness: parse the input and pretty print the ast
+//
+
+#include <cstdint>
+#include <string>
+
+#include "parser.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    auto parser = ckalei::Parser(std::make_unique<ckalei::Lexer>(std::string((const char *) data, size)));
+    auto pprinter = ckalei::PPrintorVisitor();
+    for (const auto &node: parser.getAstNodes()){
+        if (node){
+            node->accept(pprinter);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+//
+// libFuzzer harness: compile the input. The generated code is not run, a valid program may loop forever.
+//
+
+#include <cstdint>
+#include <string>
+
+#include "program.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    auto program = ckalei::Program(std::string((const char *) data, size));
+    auto assembly = program.getAssembly();
+    return 0;
+}
@@ -0,0 +1,174 @@
+//
+// Heap allocation budgets of the lexer and parser hot paths
+//
+
+#include <cstdlib>
+#include <new>
+
+#include "gtest/gtest.h"
+#include "program.h"
+
+// Budgets of the hot paths. A change making one of these tests fail adds allocations: rework it or raise the
+// budget knowingly.
+/// Allocations allowed while lexing the whole corpus, once the lexer is built
+constexpr std::size_t lexerAllocationBudget = 0;
+/// Allocations allowed per ast node while parsing the corpus, lexer construction included
+constexpr double parserAllocationsPerNodeBudget = 1.5;
+
+static thread_local std::size_t allocationCount = 0;
+
+// Count every heap allocation of the test binary
+void *operator new(std::size_t size)
+{
+    allocationCount++;
+    if (void *ptr = std::malloc(size ? size : 1)){
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+/// Count the allocations done by the current thread since its creation
+class AllocationCounter{
+public:
+    AllocationCounter(): start(allocationCount){}
+    [[nodiscard]] std::size_t count() const {return allocationCount - start;}
+
+private:
+    std::size_t start;
+};
+
+/// Count the nodes of an ast
+class NodeCounter: public ckalei::Visitor{
+public:
+    void visit(ckalei::NumberExprAST&) override {count++;}
+    void visit(ckalei::VariableExprAST&) override {count++;}
+    void visit(ckalei::UnaryExprAST& node) override {count++; node.getExpr()->accept(*this);}
+    void visit(ckalei::BinaryExprAST& node) override
+    {
+        count++;
+        node.getLeftExpr()->accept(*this);
+        node.getRightExpr()->accept(*this);
+    }
+    void visit(ckalei::DeclarationExprAST& node) override
+    {
+        count++;
+        for (const auto &var: node.getVars()){
+            if (var.second){
+                var.second->accept(*this);
+            }
+        }
+        node.getBody()->accept(*this);
+    }
+    void visit(ckalei::CallExprAST& node) override
+    {
+        count++;
+        for (const auto &arg: node.getArgs()){
+            arg->accept(*this);
+        }
+    }
+    void visit(ckalei::IfExprAST& node) override
+    {
+        count++;
+        node.getCond()->accept(*this);
+        node.getIfExpr()->accept(*this);
+        if (node.haveElseMember()){
+            node.getElseExpr()->accept(*this);
+        }
+    }
+    void visit(ckalei::ForExprAST& node) override
+    {
+        count++;
+        node.getStart()->accept(*this);
+        node.getEnd()->accept(*this);
+        node.getStep()->accept(*this);
+        node.getBody()->accept(*this);
+    }
+    void visit(ckalei::PrototypeAST&) override {count++;}
+    void visit(ckalei::FunctionAST& node) override
+    {
+        count++;
+        node.getProto()->accept(*this);
+        node.getBody()->accept(*this);
+    }
+
+    std::size_t count = 0;
+};
+
+/// Standard corpus: every construct of the language, with identifiers and numbers of various lengths
+static const char *corpus = R""""(
+    extern cos(x)
+    extern sin(angleInRadians)
+    def binary : 1 (x y) y;
+    def binary | 5 (a b)
+        if (a + b) then 1 else 0;
+    def unary ! (v)
+        if v then 0 else 1;
+    def unary - (v)
+        0 - v;
+    def fib(x)
+        if (x < 3) then
+            1
+        else
+            fib(x-1)+fib(x-2);
+    def iterativeFibonacci(x)
+        var a = 1, b = 1, c in
+        (for i = 2, i < x, 1 in
+            c = a + b:
+            a = b:
+            b = c):
+        b;
+    def polynomial(x y z)
+        3.14159265358979 * x * x + 2.71828182845904 * y - 1234567.125 / z;
+    def accumulate(start stop step)
+        var total = 0 in
+        (for counter = start, counter < stop, step in
+            total = total + cos(counter) * sin(counter)):
+        total;
+    fib(10)
+    iterativeFibonacci(25)
+    polynomial(1.5 2.5 3.5) | !0
+    accumulate(0 100 0.5);
+    -fib(3) : -polynomial(0.001 0.002 0.003)
+)"""";
+
+TEST (allocations, lexer){
+    auto lexer = ckalei::Lexer(corpus);
+
+    std::size_t tokens = 0;
+    AllocationCounter counter;
+    while (lexer.getTok() != ckalei::tok_eof){
+        tokens++;
+    }
+    auto allocations = counter.count();
+
+    ASSERT_GT(tokens, 200);
+    ASSERT_LE(allocations, lexerAllocationBudget) << "lexing " << tokens << " tokens allocated " << allocations << " times";
+}
+
+TEST (allocations, parser){
+    AllocationCounter counter;
+    auto parser = ckalei::Parser(std::make_unique<ckalei::Lexer>(corpus));
+    auto nodes = parser.getAstNodes();
+    auto allocations = counter.count();
+
+    NodeCounter nodeCounter;
+    for (const auto &node: nodes){
+        ASSERT_NE(node, nullptr);
+        node->accept(nodeCounter);
+    }
+
+    ASSERT_GT(nodeCounter.count, 120);
+    auto allocationsPerNode = (double) allocations / (double) nodeCounter.count;
+    ASSERT_LE(allocationsPerNode, parserAllocationsPerNodeBudget)
+        << "parsing " << nodeCounter.count << " nodes allocated " << allocations << " times";
+}
@@ -0,0 +1,181 @@
+//
+// Programs built from C++ with ASTBuilder
+//
+
+#include "gtest/gtest.h"
+#include "builder.h"
+
+/// Return the pretty print of a program parsed from code
+std::string parsedFormat(const std::string &code)
+{
+    return ckalei::Program(code).ppformat();
+}
+
+TEST (builder, same_ast_as_parser){
+    ckalei::ASTBuilder b;
+    ASSERT_TRUE(b.addBinaryOperator(':', 1, "x", "y", b.variable("y")));
+    std::vector<std::pair<std::string, std::unique_ptr<ckalei::ExprAST>>> vars;
+    vars.emplace_back("a", b.number(1));
+    vars.emplace_back("b", b.number(1));
+    vars.emplace_back("c", nullptr);
+    auto loopBody = b.binary(':', b.binary(':', b.assign("c", b.binary('+', b.variable("a"), b.variable("b"))),
+                                           b.assign("a", b.variable("b"))),
+                             b.assign("b", b.variable("c")));
+    auto loop = b.forLoop("i", b.number(2), b.binary('<', b.variable("i"), b.variable("x")), b.number(1),
+                          std::move(loopBody));
+    ASSERT_TRUE(b.addFunction("fib", {"x"}, b.declaration(std::move(vars),
+                                                          b.binary(':', std::move(loop), b.variable("b")))));
+    ASSERT_TRUE(b.addExpression(b.call("fib", b.number(10))));
+    auto program = b.build();
+    ASSERT_NE(program, nullptr);
+
+    auto code = R""""(
+        def binary : 1 (x y) y;
+        def fib(x)
+            var a = 1, b = 1, c in
+            (for i = 2, i < x, 1 in
+                c = a + b:
+                a = b:
+                b = c):
+            b;
+        fib(10)
+    )"""";
+    ASSERT_EQ(program->ppformat(), parsedFormat(code));
+    ASSERT_EQ(*program->evaluate(), std::vector<double>{55});
+}
+
+TEST (builder, recursion_and_operators){
+    ckalei::ASTBuilder b;
+    ASSERT_TRUE(b.addUnaryOperator('!', "v", b.ifThenElse(b.variable("v"), b.number(0), b.number(1))));
+    ASSERT_TRUE(b.addFunction("fact", {"n"},
+                              b.ifThenElse(b.binary('<', b.variable("n"), b.number(2)),
+                                           b.number(1),
+                                           b.binary('*', b.variable("n"),
+                                                    b.call("fact", b.binary('-', b.variable("n"), b.number(1)))))));
+    ASSERT_TRUE(b.addFunction("answer", {}, b.number(42)));
+    ASSERT_TRUE(b.addExpression(b.call("fact", b.number(5))));
+    ASSERT_TRUE(b.addExpression(b.unary('!', b.call("answer"))));
+    auto program = b.build();
+    ASSERT_NE(program, nullptr);
+    ASSERT_EQ(*program->evaluate(), (std::vector<double>{120, 0}));
+}
+
+TEST (builder, validation){
+    ckalei::ASTBuilder b;
+    // names and operators
+    ASSERT_EQ(b.variable("1x"), nullptr);
+    ASSERT_EQ(b.variable("then"), nullptr);
+    ASSERT_EQ(b.binary('(', b.number(1), b.number(2)), nullptr);
+    ASSERT_EQ(b.binary('=', b.variable("x"), b.number(2)), nullptr);
+    ASSERT_FALSE(b.addBinaryOperator('+', 10, "x", "y", b.variable("x")));
+    ASSERT_FALSE(b.addBinaryOperator('|', 0, "x", "y", b.variable("x")));
+    ASSERT_FALSE(b.addFunction("f", {"x", "1x"}, b.variable("x")));
+    ASSERT_EQ(b.getErrorCount(), 7);
+
+    // scopes, calls and operators are resolved like code generation does
+    ASSERT_FALSE(b.addFunction("f", {"x"}, b.variable("y")));
+    ASSERT_FALSE(b.addExpression(b.call("g", b.number(1))));
+    ASSERT_TRUE(b.addExtern("sin", {"x"}));
+    ASSERT_FALSE(b.addExpression(b.call("sin")));
+    ASSERT_FALSE(b.addExpression(b.unary('!', b.number(1))));
+    ASSERT_FALSE(b.addExpression(b.binary('|', b.number(1), b.number(2))));
+    ASSERT_FALSE(b.addExpression(
+            b.forLoop("i", b.variable("i"), b.number(1), b.number(1), b.number(0)))) << "start is out of the loop";
+    ASSERT_TRUE(b.addFunction("f", {"x"}, b.variable("x")));
+    ASSERT_FALSE(b.addFunction("f", {"x", "y"}, b.variable("x"))) << "redefinition with another arity";
+    // a null operand rejects the whole expression
+    ASSERT_FALSE(b.addExpression(b.binary('+', b.number(1), b.variable("2"))));
+    ASSERT_EQ(b.build(), nullptr);
+
+    // build resets the builder
+    ASSERT_TRUE(b.addExpression(b.number(1)));
+    ASSERT_NE(b.build(), nullptr);
+}
+
+TEST (builder, parser_parity){
+    // redefinitions are accepted like the parser does, the last one is called
+    ckalei::ASTBuilder b;
+    ASSERT_TRUE(b.addFunction("f", {"x"}, b.variable("x")));
+    ASSERT_TRUE(b.addExpression(b.call("f", b.number(1))));
+    ASSERT_TRUE(b.addFunction("f", {"x"}, b.binary('*', b.variable("x"), b.number(2))));
+    ASSERT_TRUE(b.addExpression(b.call("f", b.number(1))));
+    // and so are duplicated arguments
+    ASSERT_TRUE(b.addFunction("g", {"x", "x"}, b.variable("x")));
+    ASSERT_TRUE(b.addExpression(b.call("g", b.number(1), b.number(2))));
+    auto program = b.build();
+    ASSERT_NE(program, nullptr);
+    auto code = "def f(x) x; f(1) def f(x) x * 2; f(1) def g(x x) x; g(1 2)";
+    ASSERT_EQ(program->ppformat(), parsedFormat(code));
+    ASSERT_EQ(*program->evaluate(), *ckalei::Program(code).evaluate());
+
+    // expressions are bounded like the parser does, the programs built can be read back from their ast file
+    auto chain = [&b](int operators){
+        auto expr = b.number(1);
+        for (int i = 0; i < operators; i++){
+            expr = b.binary('+', std::move(expr), b.number(1));
+        }
+        return expr;
+    };
+    ASSERT_FALSE(b.addExpression(chain(ckalei::MAX_NESTING_DEPTH)));
+    ASSERT_EQ(b.build(), nullptr);
+    ASSERT_TRUE(b.addExpression(chain(ckalei::MAX_NESTING_DEPTH - 1)));
+    program = b.build();
+    ASSERT_NE(program, nullptr);
+    llvm::SmallString<128> path;
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testBuilder", "kast", path));
+    ASSERT_TRUE(program->saveAst(path.str().str()));
+    auto loaded = ckalei::Program::loadAst(path.str().str());
+    llvm::sys::fs::remove(path);
+    ASSERT_NE(loaded, nullptr);
+    ASSERT_EQ(*loaded->evaluate(), std::vector<double>({ckalei::MAX_NESTING_DEPTH}));
+}
+
+TEST (builder, types){
+    using ckalei::type_f32;
+    using ckalei::type_f64;
+    using ckalei::type_i64;
+    ckalei::ASTBuilder b;
+    ASSERT_TRUE(b.addBinaryOperator(':', 1, "x", "y", b.variable("y"), {type_f64, type_i64}, type_i64));
+    std::vector<std::pair<std::string, std::unique_ptr<ckalei::ExprAST>>> vars;
+    vars.emplace_back("s", b.number(0));
+    auto loop = b.forLoop("i", b.number(0), b.binary('<', b.variable("i"), b.variable("n")), b.number(1),
+                          b.assign("s", b.binary('+', b.variable("s"), b.variable("i"))), type_i64);
+    ASSERT_TRUE(b.addFunction("sum", {"n"}, b.declaration(std::move(vars), b.binary(':', std::move(loop),
+                                                                                    b.variable("s")), {type_i64}),
+                              {type_i64}, type_i64));
+    ASSERT_TRUE(b.addFunction("half", {"x"}, b.binary('*', b.variable("x"), b.number(0.5)), {type_f32}, type_f32));
+    ASSERT_TRUE(b.addExpression(b.call("half", b.call("tof32", b.call("sum", b.number(10))))));
+    auto program = b.build();
+    ASSERT_NE(program, nullptr);
+
+    auto code = R""""(
+        def binary : 1 (x y:i64):i64 y;
+        def sum(n:i64):i64
+            var s:i64 = 0 in
+            (for i:i64 = 0, i < n, 1 in
+                s = s + i):
+            s;
+        def half(x:f32):f32 x * 0.5;
+        half(tof32(sum(10)))
+    )"""";
+    ASSERT_EQ(program->ppformat(), parsedFormat(code));
+    ASSERT_EQ(*program->evaluate(), std::vector<double>{22.5});
+
+    // types are checked like code generation does
+    ASSERT_TRUE(b.addExtern("isqrt", {"x"}, {type_i64}, type_i64));
+    ASSERT_FALSE(b.addFunction("f", {"x", "y"}, b.binary('*', b.variable("x"), b.variable("y")),
+                               {type_i64, type_f64})) << "i64 times f64";
+    ASSERT_FALSE(b.addFunction("f", {"x"}, b.binary('+', b.variable("x"), b.number(0.5)), {type_i64}))
+            << "literal which is not an i64";
+    ASSERT_FALSE(b.addExpression(b.call("isqrt", b.call("tof32", b.number(4))))) << "f32 argument of an i64";
+    ASSERT_FALSE(b.addFunction("f", {"x"}, b.variable("x"), {type_i64})) << "returns an i64 as an f64";
+    vars.clear();
+    vars.emplace_back("a", b.number(1));
+    vars.emplace_back("b", b.number(2));
+    ASSERT_FALSE(b.addExpression(b.declaration(std::move(vars), b.variable("a"), {type_i64}))) << "one type for two";
+    ASSERT_FALSE(b.addFunction("isqrt", {"x"}, b.variable("x"))) << "redefinition with other types";
+    ASSERT_FALSE(b.addFunction("g", {"x", "y"}, b.variable("x"), {type_i64})) << "one type for two arguments";
+    ASSERT_TRUE(b.addFunction("f", {"x"}, b.call("tof64", b.call("isqrt", b.variable("x"))), {type_i64}));
+    ASSERT_TRUE(b.addExpression(b.call("f", b.number(16))));
+    ASSERT_EQ(b.build(), nullptr);
+}
@@ -0,0 +1,186 @@
+//
+// Structural properties of the optimized code of reference kernels. These tests guard the optimisation pipeline:
+// a failure means a pass stopped doing its job, even if results are still right.
+//
+
+#include "gtest/gtest.h"
+#include "program.h"
+
+/// Return the IR of the function name found in the IR listing of a program
+std::string functionIR(const std::string &listing, const std::string &name)
+{
+    auto begin = listing.find("@" + name + "(");
+    if (begin == std::string::npos){
+        return "";
+    }
+    begin = listing.rfind("define ", begin);
+    auto end = listing.find("\n}\n", begin);
+    return listing.substr(begin, end - begin);
+}
+
+/// Return the native assembly of the function name found in the assembly listing of a program
+std::string functionAssembly(const std::string &listing, const std::string &name)
+{
+    auto begin = listing.find("\n" + name + ":\n");
+    if (begin == std::string::npos){
+        return "";
+    }
+    auto end = listing.find(".Lfunc_end", begin);
+    return listing.substr(begin, end - begin);
+}
+
+/// Return the number of IR instructions of a function
+int instructionCount(const std::string &functionIr)
+{
+    int count = 0;
+    std::istringstream lines(functionIr);
+    std::string line;
+    while (std::getline(lines, line)){
+        if (line.rfind("  ", 0) == 0){ // instructions are indented, labels and braces are not
+            count++;
+        }
+    }
+    return count;
+}
+
+bool contains(const std::string &str, const std::string &pattern)
+{
+    return str.find(pattern) != std::string::npos;
+}
+
+static const char *kernels = R""""(
+    def binary : 1 (x y) y;
+    def iterativeFib(x)
+        var a = 1, b = 1, c in
+        (for i = 2, i < x, 1 in
+            c = a + b:
+            a = b:
+            b = c):
+        b;
+    def clamp(x)
+        if x < 0 then 0 else x;
+    def seven()
+        2 * 3 + 1;
+    def square(x)
+        x * x;
+    def mutate(x y)
+        x = y * x + 1: x;
+)"""";
+
+TEST (codeQuality, mem2reg){
+    auto program = ckalei::Program(kernels);
+    auto listing = program.getAssembly();
+    for (const auto &name: {"iterativeFib", "mutate"}){
+        auto ir = functionIR(listing, name);
+        ASSERT_FALSE(ir.empty()) << name;
+        ASSERT_FALSE(contains(ir, "alloca")) << ir;
+        ASSERT_FALSE(contains(ir, "load")) << ir;
+        ASSERT_FALSE(contains(ir, "store")) << ir;
+    }
+}
+
+TEST (codeQuality, debug_keeps_memory_traffic){
+    auto program = ckalei::Program(kernels);
+    auto ir = functionIR(program.getAssembly(true), "mutate");
+    ASSERT_TRUE(contains(ir, "alloca")) << ir;
+}
+
+TEST (codeQuality, direct_ssa){
+    // without mem2reg, only the assigned variables live in memory
+    auto listing = ckalei::Program(kernels).getAssembly(true);
+    for (const auto &name: {"clamp", "square"}){
+        auto ir = functionIR(listing, name);
+        ASSERT_FALSE(contains(ir, "alloca")) << ir;
+    }
+    auto ir = functionIR(listing, "iterativeFib");
+    ASSERT_FALSE(contains(ir, "%x = alloca")) << ir;
+    ASSERT_FALSE(contains(ir, "%i = alloca")) << ir;
+    ASSERT_TRUE(contains(ir, "phi")) << ir;
+}
+
+TEST (codeQuality, instruction_count){
+    auto program = ckalei::Program(kernels);
+    auto listing = program.getAssembly();
+    ASSERT_LE(instructionCount(functionIR(listing, "iterativeFib")), 14);
+    ASSERT_LE(instructionCount(functionIR(listing, "mutate")), 4);
+    ASSERT_LE(instructionCount(functionIR(listing, "square")), 2);
+}
+
+TEST (codeQuality, constant_folding){
+    auto program = ckalei::Program(kernels);
+    auto ir = functionIR(program.getAssembly(), "seven");
+    ASSERT_EQ(instructionCount(ir), 1) << ir;
+    ASSERT_TRUE(contains(ir, "ret double 7.0")) << ir;
+}
+
+TEST (codeQuality, if_to_select){
+    auto program = ckalei::Program(kernels);
+    auto ir = functionIR(program.getAssembly(), "clamp");
+    ASSERT_TRUE(contains(ir, "select")) << ir;
+    ASSERT_FALSE(contains(ir, "br ")) << ir;
+}
+
+TEST (codeQuality, select_without_simplifycfg){
+    auto listing = ckalei::Program(kernels).getAssembly(true);
+    auto ir = functionIR(listing, "clamp");
+    ASSERT_TRUE(contains(ir, "select")) << ir;
+    ASSERT_FALSE(contains(ir, "br ")) << ir;
+
+    // calls may have side effects, they stay behind a branch
+    ir = functionIR(ckalei::Program("extern sin(x)\n def f(x) if x < 0 then sin(x) else x;").getAssembly(true), "f");
+    ASSERT_TRUE(contains(ir, "br ")) << ir;
+    ASSERT_FALSE(contains(ir, "select")) << ir;
+}
+
+TEST (codeQuality, boolean_conditions){
+    // comparisons feeding a condition stay i1, even without optimisation
+    auto program = ckalei::Program("def inRange(x) if x >= 0 && x <= 10 then x else 0;");
+    auto ir = functionIR(program.getAssembly(true), "inRange");
+    ASSERT_FALSE(contains(ir, "uitofp")) << ir;
+    ASSERT_FALSE(contains(ir, "fcmp one")) << ir;
+    ASSERT_FALSE(contains(ir, "call")) << ir;
+}
+
+TEST (codeQuality, inline_operators){
+    // small operators cost the same as built in ones, even without the optimisation passes
+    auto ir = functionIR(ckalei::Program(kernels).getAssembly(true), "iterativeFib");
+    ASSERT_FALSE(contains(ir, "call")) << ir;
+}
+
+TEST (codeQuality, typed_arithmetic){
+    // integers and single precision values get their own instructions, without conversions
+    auto program = ckalei::Program(R""""(
+        def binary : 1 (x y:i64):i64 y;
+        def sum(n:i64):i64 var s:i64 = 0 in (for i:i64 = 0, i < n, 1 in s = s + i) : s;
+        def half(x:f32):f32 x * 0.5;
+    )"""");
+    auto listing = program.getAssembly(true);
+    auto sum = functionIR(listing, "sum");
+    ASSERT_TRUE(contains(sum, "add i64")) << sum;
+    ASSERT_TRUE(contains(sum, "icmp slt i64")) << sum;
+    ASSERT_FALSE(contains(sum, "fadd")) << sum;
+    ASSERT_FALSE(contains(sum, "sitofp")) << sum;
+    auto half = functionIR(listing, "half");
+    ASSERT_TRUE(contains(half, "fmul float")) << half;
+    ASSERT_FALSE(contains(half, "fpext")) << half;
+}
+
+TEST (codeQuality, integer_inference){
+    // loop variables and counters holding integers get integer instructions without annotations
+    auto program = ckalei::Program(R""""(
+        def binary : 1 (x y) y;
+        def countTo() var c = 0 in (for i = 0, i < 100, 1 in c = c + 1) : c;
+    )"""");
+    auto ir = functionIR(program.getAssembly(true), "countTo");
+    ASSERT_TRUE(contains(ir, "add i64")) << ir;
+    ASSERT_TRUE(contains(ir, "icmp slt i64")) << ir;
+    ASSERT_FALSE(contains(ir, "fadd")) << ir;
+}
+
+TEST (codeQuality, native_no_spill){
+    auto program = ckalei::Program(kernels);
+    auto assembly = functionAssembly(program.getNativeAssembly(), "square");
+    ASSERT_FALSE(assembly.empty());
+    ASSERT_TRUE(contains(assembly, "mulsd")) << assembly;
+    ASSERT_FALSE(contains(assembly, "(%rsp)")) << assembly;
+}
@@ -5,6 +5,11 @@
 
 #include "gtest/gtest.h"
 #include "program.h"
+#include "session.h"
+
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
 
 void testVectorEqual(const std::vector<double>& v1, const std::vector<double>& v2)
 {
@@ -247,6 +252,144 @@ TEST (jit, variableAssigment){
     testVectorEqual(expected, res);
 }
 
+TEST (jit, variable_scopes){
+    auto data = R""""(
+        def binary : 1 (x y) y;
+        def outer(a) (var b = 1 in b) + a;
+        def shadow(x) (var x = x + 1, x = x * 10 in x) + x;
+        def loop(n) (for i = 0, i < n, 1 in (var i = 5 in i)) + (var s = 0 in (for i = 1, i < n, i in s = s + i) : s);
+        def counter(x) for x = x, x < 10, 1 in x = x + 1;
+        outer(2) shadow(1) loop(4) counter(0)
+    )"""";
+    std::vector<double> expected{3, 21, 3, 0};
+    auto program = ckalei::Program(data);
+    testVectorEqual(expected, *program.evaluate());
+    ckalei::JitOptions options;
+    options.directSsa = false;
+    testVectorEqual(expected, *program.evaluate(options));
+}
+
+TEST (jit, comparisons_and_logic){
+    auto data = R""""(
+        def binary : 1 (x y) y;
+        def unary ! (v) if v then 0 else 1;
+        def sign(x) (x > 0) - (x < 0);
+        def inRange(x) x >= 0 && x <= 10;
+        def outside(x) x < 0 || x > 10;
+        def flag(n) var hit = 0 in (n != 0 && (hit = 1)) : hit;
+        def either(n) var hit = 0 in (n == 0 || (hit = 1)) : hit;
+        sign(0 - 3) sign(0) sign(7)
+        inRange(0) inRange(10) inRange(11) outside(5) outside(0 - 1)
+        flag(0) flag(2) either(0) either(2)
+        if 1 == 1 && !(2 != 2) then 3 else 4
+        2 < 1 + 1 == 0
+    )"""";
+    std::vector<double> expected{-1, 0, 1, 1, 1, 0, 0, 1, 0, 1, 0, 1, 3, 1};
+    auto program = ckalei::Program(data);
+    testVectorEqual(expected, *program.evaluate());
+}
+
+TEST (jit, inline_operators){
+    auto data = R""""(
+        def binary : 1 (x y) y;
+        def binary ^ 5 (a b) a + a + b;
+        def binary ~ 5 (x y) x - y;
+        def binary @ 5 (a b) (a = a * b) : a;
+        def binary % 30 (b e) if e < 1 then 1 else b * (b % (e - 1));
+        def unary - (v) 0 - v;
+        def twice(y x) y ~ x ~ -x;
+        def scale(x) (x @ 2) + x;
+        var n = 0 in ((n = n + 1) ^ 0) + n
+        twice(10 3) scale(3) 2 % 10
+    )"""";
+    std::vector<double> expected{3, 10, 9, 1024};
+    auto program = ckalei::Program(data);
+    testVectorEqual(expected, *program.evaluate());
+    ckalei::JitOptions options;
+    options.inlineOperators = false;
+    testVectorEqual(expected, *program.evaluate(options));
+    options.inlineOperators = true;
+    options.threads = 2;
+    testVectorEqual(expected, *program.evaluate(options));
+
+    // a redefinition is seen by the functions compiled before it, whether they expanded or called the operator
+    for (bool inlineOperators: {true, false}){
+        ckalei::JitOptions sessionOptions;
+        sessionOptions.inlineOperators = inlineOperators;
+        auto session = ckalei::Session(sessionOptions);
+        session.evaluate("def binary ~ 5 (x y) x - y; def binary @ 5 (x y) x ~ y; def f(x) x ~ 1; def h(x) x @ 1;");
+        session.evaluate("def binary ~ 5 (x y) x + y; def g(x) x ~ 1;");
+        ASSERT_EQ(*session.evaluate("f(5) g(5) h(5) 5 @ 1"), (std::vector<double>{6, 6, 6, 6})) << inlineOperators;
+    }
+}
+
+TEST (jit, typed_values){
+    auto data = R""""(
+        def binary : 1 (x y:i64):i64 y;
+        def sum(n:i64):i64 var s:i64 = 0 in (for i:i64 = 0, i < n, 1 in s = s + i) : s;
+        def ifib(n:i64):i64 if n < 3 then 1 else ifib(n - 1) + ifib(n - 2);
+        def idiv(a:i64 b:i64):i64 a / b;
+        def safeDiv(a:i64 b:i64):i64 if b == 0 then 0 else a / b;
+        def half(x:f32):f32 x * 0.5;
+        sum(10) ifib(25) idiv(7 2) idiv(toi64(0 - 7) 2) safeDiv(1 0)
+        half(tof32(3)) tof64(tof32(0.1)) == 0.1 tof64(toi64(2.9)) + 0.5
+    )"""";
+    std::vector<double> expected{45, 75025, 3, -3, 0, 1.5, 0, 2.5};
+    auto program = ckalei::Program(data);
+    testVectorEqual(expected, *program.evaluate());
+    ckalei::JitOptions options;
+    options.directSsa = false;
+    testVectorEqual(expected, *program.evaluate(options));
+
+    // integer division and conversions are defined for every value but a zero divisor
+    auto edges = ckalei::Program(R""""(
+        def idiv(a:i64 b:i64):i64 a / b;
+        def toInteger(x):i64 toi64(x);
+        idiv(toi64(0 - 100000000000000000000) toi64(0 - 1)) toInteger(100000000000000000000) toInteger(0 / 0)
+    )"""");
+    std::vector<double> edgeValues{-0x1p63, 0x1p63, 0};
+    testVectorEqual(edgeValues, *edges.evaluate());
+    testVectorEqual(edgeValues, *edges.evaluate(options));
+    ASSERT_DEATH(ckalei::Program("def idiv(a:i64 b:i64):i64 a / b; idiv(1 0)").evaluate(), "");
+
+    // values of different types only mix through explicit conversions, number literals take the type they need
+    auto session = ckalei::Session();
+    ASSERT_TRUE(session.evaluate("var n:i64 = 2 in n * 1.5")->empty());
+    ASSERT_TRUE(session.evaluate("var n:i64 = 2, x = 1 in n * x")->empty());
+    ASSERT_EQ(*session.evaluate("var n:i64 = 2, x = 1 in tof64(n) * x"), (std::vector<double>{2}));
+
+    // a redefinition keeps the signature the callers compiled before it are bound to
+    session.evaluate("def f(x) x + 1; def g(x) f(x);");
+    session.evaluate("def f(x:i64):i64 x; extern f(x:f32)");
+    ASSERT_EQ(*session.evaluate("f(2)"), std::vector<double>{3});
+    session.evaluate("def f(x) x + 2;");
+    ASSERT_EQ(*session.evaluate("g(2) f(2)"), (std::vector<double>{4, 4}));
+}
+
+TEST (jit, integer_inference){
+    auto data = R""""(
+        def binary : 1 (x y) y;
+        def count(n) var c = 0 in (for i = 0, i < n, 1 in if i / 2 < 3 then c = c + 1 else 0) : c;
+        def sumHalves(n) var s = 0 in (for i = 0, i < n, 1 in s = s + i / 2) : s;
+        def shadow(n) var s = 0 in (for i = 0, i < n, 1 in var i = 0.5 in s = s + i) : s;
+        def down(n) var c = 10 in (for i = 0, i < n, 1 in c = c - 2) : c;
+        def skip(n) var c = 0 in (for i = 0, i < n, 1 in (i = i + 1) : c = 1 + c) : c;
+        def frac() var c = 0 in (for i = 0, i < 2.5, 1 in c = 1 + c) : c;
+        count(10) sumHalves(4) shadow(3) down(3) skip(10) frac()
+        var c = 7 in (c = 2) : c + 0.5
+    )"""";
+    // inferred integers give the values the doubles gave
+    std::vector<double> expected{6, 3, 1.5, 4, 5, 3, 2.5};
+    auto program = ckalei::Program(data);
+    testVectorEqual(expected, *program.evaluate());
+    ckalei::JitOptions options;
+    options.directSsa = false;
+    testVectorEqual(expected, *program.evaluate(options));
+    options.directSsa = true;
+    options.inferIntegers = false;
+    testVectorEqual(expected, *program.evaluate(options));
+}
+
 TEST (jit, div){
     auto data = R""""(
         4 / 2
@@ -256,3 +399,297 @@ TEST (jit, div){
     auto res = *program.evaluate();
     testVectorEqual(expected, res);
 }
+
+TEST (jit, native_assembly){
+    auto data = R""""(
+        extern sin(x)
+        def mult(a b) a*b;
+        mult(3 4)
+    )"""";
+    auto program = ckalei::Program(data);
+    auto assembly = program.getNativeAssembly();
+    ASSERT_NE(assembly.find("mult:"), std::string::npos);
+    ASSERT_NE(assembly.find("__anon_expr:"), std::string::npos);
+    ASSERT_EQ(assembly.find("sin:"), std::string::npos) << "declarations must not produce code";
+}
+
+TEST (jit, memory_stats){
+    auto data = R""""(
+        def mult(a b) a*b;
+        mult(3 4)
+    )"""";
+    auto program = ckalei::Program(data);
+    auto &memory = program.getStats().memory;
+    ASSERT_GE(memory.sourceBytes, 2 * strlen(data));
+    ASSERT_GT(memory.astBytes, 0);
+    ASSERT_EQ(memory.jitCodeBytes, 0);
+
+    auto res = program.evaluate();
+    ASSERT_GT(memory.irBytes, 0);
+    ASSERT_GT(memory.jitCodeBytes, 0);
+    ASSERT_GE(memory.peakBytes, memory.sourceBytes + memory.astBytes + memory.jitCodeBytes);
+}
+
+TEST (jit, module_budget){
+    std::string data = "def f0(x) x + 1;\n";
+    for (int i = 1; i < 300; i++){
+        data += "def f" + std::to_string(i) + "(x) f" + std::to_string(i - 1) + "(x) * 1 + 1;\n";
+    }
+    // a redefinition in the middle of a batch and expressions between definitions
+    data += "f299(0)\n def f0(x) x + 2;\n def g(x) f0(x);\n def g2(x) f1(x); g(0) g2(0)\n";
+
+    auto program = ckalei::Program(data);
+    auto alone = *program.evaluate();
+    auto aloneIrBytes = program.getStats().memory.irBytes;
+    ckalei::JitOptions options;
+    options.moduleBudget = 1 << 16;
+    auto batched = *program.evaluate(options);
+    ASSERT_EQ(alone, (std::vector<double>{300, 2, 2}));
+    ASSERT_EQ(batched, alone);
+    ASSERT_GT(program.getStats().memory.irBytes, 10 * aloneIrBytes) << "definitions must share modules";
+
+    // a context created for each module, as measured by benchDefinitions
+    options.reuseContext = false;
+    ASSERT_EQ(*program.evaluate(options), alone);
+    options.moduleBudget = 0;
+    ASSERT_EQ(*program.evaluate(options), alone);
+}
+
+TEST (jit, parallel_compilation){
+    std::string data = "def binary : 1 (x y) y;\n def f0(x) x + 1;\n";
+    for (int i = 1; i < 200; i++){
+        // calls reach across the chunks of the threads
+        data += "def f" + std::to_string(i) + "(x) f" + std::to_string(i - 1) + "(x) + f" + std::to_string(i / 2) +
+                "(0) * 0 + 1;\n";
+    }
+    // an expression, a redefinition and a definition failing to compile split the runs of definitions
+    data += "f199(0)\n def f5(x) 0;\n def broken(x) unknown(x);\n";
+    for (int i = 0; i < 50; i++){
+        data += "def g" + std::to_string(i) + "(x) f5(x) + f199(x) + " + std::to_string(i) + ";\n";
+    }
+    data += "g49(1) f6(0)\n";
+
+    auto program = ckalei::Program(data);
+    auto serial = *program.evaluate();
+    ASSERT_EQ(serial, (std::vector<double>{200, 250, 7}));
+    ckalei::JitOptions options;
+    options.threads = 4;
+    ASSERT_EQ(*program.evaluate(options), serial);
+}
+
+TEST (jit, whole_program){
+    auto data = R""""(
+        extern sqrt(x)
+        def binary : 1 (x y) y;
+        def square(x) x * x;
+        def unused(x) x + 1;
+        def norm(x y) sqrt(square(x) + square(y));
+        def sumTo(n)
+            var s = 0 in
+            (for i = 1, i < n + 1, 1 in s = s + i):
+            s;
+        norm(3 4)
+        sumTo(100)
+        norm(5 12) : norm(8 15)
+    )"""";
+    auto program = ckalei::Program(data);
+    ckalei::JitOptions options;
+    options.wholeProgram = true;
+    ASSERT_EQ(*program.evaluate(options), *program.evaluate());
+    ASSERT_EQ(*program.evaluate(options), (std::vector<double>{5, 5050, 17}));
+
+    // only the entry points stay callable
+    options.entryPoints = {"norm"};
+    auto session = ckalei::Session(options);
+    session.evaluate(data);
+    ASSERT_EQ(*session.evaluate("norm(6 8)"), std::vector<double>{10});
+    ASSERT_TRUE(session.evaluate("square(2)")->empty());
+}
+
+TEST (jit, split_module){
+    std::string data = "def binary : 1 (x y) y;\n def f0(x) x + 1;\n";
+    for (int i = 1; i < 40; i++){
+        data += "def f" + std::to_string(i) + "(x) f" + std::to_string(i - 1) + "(x) + f" + std::to_string(i / 2) +
+                "(0) * 0 + 1;\n";
+    }
+    data += "def fact(n) if n < 2 then 1 else n * fact(n - 1);\n f39(0) fact(5) f20(fact(3))\n";
+    auto program = ckalei::Program(data);
+    auto serial = *program.evaluate();
+    ASSERT_EQ(serial, (std::vector<double>{40, 120, 27}));
+
+    // every module is split, the parts call each other
+    ckalei::JitOptions options;
+    options.threads = 3;
+    options.splitBytes = 0;
+    options.moduleBudget = 1 << 20;
+    ASSERT_EQ(*program.evaluate(options), serial);
+    // internal definitions called from another part stay linkable
+    options.wholeProgram = true;
+    ASSERT_EQ(*program.evaluate(options), serial);
+}
+
+TEST (jit, split_module_session){
+    ckalei::JitOptions options;
+    options.threads = 3;
+    options.splitBytes = 0;
+    llvm::SmallString<128> before, after;
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testSplit", "ksnp", before));
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testSplit", "ksnp", after));
+
+    // every part of a top level expression is freed with it
+    auto session = ckalei::Session(options);
+    session.evaluate("def f(x) x * 2; def g(x) f(x) + 1;");
+    ASSERT_TRUE(session.saveSnapshot(before.str().str()));
+    for (int i = 0; i < 5; i++){
+        ASSERT_EQ(*session.evaluate("g(1) f(2) g(3)"), (std::vector<double>{3, 4, 7}));
+    }
+    ASSERT_TRUE(session.saveSnapshot(after.str().str()));
+    uint64_t beforeSize, afterSize;
+    ASSERT_FALSE(llvm::sys::fs::file_size(before, beforeSize));
+    ASSERT_FALSE(llvm::sys::fs::file_size(after, afterSize));
+    ASSERT_EQ(beforeSize, afterSize);
+    llvm::sys::fs::remove(before);
+    llvm::sys::fs::remove(after);
+
+    // internalised definitions keep calling each other once their names are redefined
+    options.wholeProgram = true;
+    options.entryPoints = {"f"};
+    auto wholeSession = ckalei::Session(options);
+    wholeSession.evaluate("def helper(n) if n < 1 then 1 else helper(n - 1) + 1; def f(x) helper(x) * 2;");
+    ASSERT_EQ(*wholeSession.evaluate("def helper(x) x + 100; f(1) helper(1)"), (std::vector<double>{4, 101}));
+}
+
+TEST (jit, prune_unreachable){
+    auto data = R""""(
+        extern sin(x)
+        def binary % 50 (a b) a - b * b;
+        def binary & 5 (a b) a * b;
+        def unary ! (v) 0 - v;
+        def fact(n) if n < 2 then 1 else n * fact(n - 1);
+        def helper(x) x % 2;
+        def used(x) !helper(x);
+        def unused(x) sin(x) & fact(x);
+        def used(x) x;
+        used(5)
+        fact(used(3))
+    )"""";
+    auto program = ckalei::Program(data);
+    auto expected = *program.evaluate();
+    ASSERT_EQ(program.pruneUnreachable(), 2u) << "unused and the '&' operator only it uses";
+    ASSERT_EQ(*program.evaluate(), expected);
+    auto pprint = program.ppformat();
+    ASSERT_EQ(pprint.find("unused"), std::string::npos);
+    ASSERT_NE(pprint.find("binary%"), std::string::npos);
+    ASSERT_NE(pprint.find("fact"), std::string::npos);
+
+    auto exported = ckalei::Program(data);
+    ASSERT_EQ(exported.pruneUnreachable({"unused"}), 0u);
+}
+
+TEST (jit, aot_shared_library){
+    auto data = R""""(
+        def binary : 1 (x y) y;
+        def aotFib(x)
+            var a = 1, b = 1, c in
+            (for i = 2, i < x, 1 in
+                c = a + b:
+                a = b:
+                b = c):
+            b;
+        aotFib(10)
+    )"""";
+    auto program = ckalei::Program(data);
+    llvm::SmallString<128> library;
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testAot", "so", library));
+    ASSERT_TRUE(program.emitSharedLibrary(library.str().str()));
+
+    std::string error;
+    auto handle = llvm::sys::DynamicLibrary::getPermanentLibrary(library.c_str(), &error);
+    ASSERT_TRUE(handle.isValid()) << error;
+    auto fib = (double (*)(double)) handle.getAddressOfSymbol("aotFib");
+    ASSERT_NE(fib, nullptr);
+    ASSERT_EQ(fib(10), 55);
+    ASSERT_EQ(handle.getAddressOfSymbol("__anon_expr"), nullptr) << "top level expressions are not exported";
+
+    ckalei::AotOptions options;
+    options.optLevel = ckalei::MAX_OPT_LEVEL + 1;
+    ASSERT_FALSE(program.emitSharedLibrary(library.str().str(), options));
+    llvm::sys::fs::remove(library);
+}
+
+TEST (jit, c_header){
+    auto data = R""""(
+        extern sin(x)
+        def binary : 1 (x y) y;
+        def mult(a b) a*b;
+        def answer() 42;
+        mult(3 4)
+    )"""";
+    auto program = ckalei::Program(data);
+    auto header = program.getCHeader("TEST_H");
+    ASSERT_NE(header.find("#ifndef TEST_H"), std::string::npos);
+    ASSERT_NE(header.find("double mult(double a, double b);"), std::string::npos) << header;
+    ASSERT_NE(header.find("double answer(void);"), std::string::npos) << header;
+    ASSERT_EQ(header.find("sin"), std::string::npos) << "externs are not defined by the program";
+    ASSERT_EQ(header.find("binary"), std::string::npos) << "operators have no C name";
+    ASSERT_EQ(header.find("__anon_expr"), std::string::npos);
+}
+
+TEST (jit, aot_executable){
+    auto data = R""""(
+        extern putchard(c)
+        def fib(x)
+            if (x < 3) then
+                1
+            else
+                fib(x-1)+fib(x-2);
+        fib(10)
+        putchard(65) + 0.5
+    )"""";
+    auto program = ckalei::Program(data);
+    llvm::SmallString<128> executable, output;
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testAot", "", executable));
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testAot", "txt", output));
+    ASSERT_TRUE(program.emitExecutable(executable.str().str()));
+
+    llvm::Optional<llvm::StringRef> redirects[] = {llvm::None, llvm::StringRef(output), llvm::None};
+    ASSERT_EQ(llvm::sys::ExecuteAndWait(executable, {executable}, llvm::None, redirects), 0);
+    auto buffer = llvm::MemoryBuffer::getFile(output);
+    ASSERT_TRUE(buffer);
+    ASSERT_EQ((*buffer)->getBuffer().str(), "55\nA0.5\n");
+    llvm::sys::fs::remove(executable);
+    llvm::sys::fs::remove(output);
+}
+
+TEST (jit, aot_large_output){
+    // printd writes all the digits of a large double: the output buffer is flushed before any value overflows it
+    auto data = R""""(
+        extern printd(x)
+        def binary : 1 (x y) y;
+        def big() var x = 1 in (for i = 0, i < 300, 1 in x = x * 10) : x;
+        for i = 0, i < 1000, 1 in printd(big())
+    )"""";
+    auto program = ckalei::Program(data);
+    llvm::SmallString<128> executable, output;
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testAot", "", executable));
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testAot", "txt", output));
+    ASSERT_TRUE(program.emitExecutable(executable.str().str()));
+
+    llvm::Optional<llvm::StringRef> redirects[] = {llvm::None, llvm::StringRef(output), llvm::None};
+    ASSERT_EQ(llvm::sys::ExecuteAndWait(executable, {executable}, llvm::None, redirects), 0);
+    auto buffer = llvm::MemoryBuffer::getFile(output);
+    ASSERT_TRUE(buffer);
+    double big = 1;
+    for (int i = 0; i < 300; i++){
+        big *= 10;
+    }
+    char line[512];
+    snprintf(line, sizeof(line), "%f\n", big);
+    std::string expected;
+    for (int i = 0; i < 1000; i++){
+        expected += line;
+    }
+    ASSERT_EQ((*buffer)->getBuffer().str(), expected + "0\n");
+    llvm::sys::fs::remove(executable);
+    llvm::sys::fs::remove(output);
+}
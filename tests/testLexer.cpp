@@ -118,6 +118,22 @@ TEST (lexer, operators){
     assertTok(lexer, ckalei::tok_unary);
 }
 
+TEST (lexer, two_char_operators){
+    auto data = "a<=b >= == != && || < =!";
+    auto lexer = ckalei::Lexer(data);
+    assertTokIdentifier(lexer, "a");
+    assertTokOther(lexer, ckalei::op_le);
+    assertTokIdentifier(lexer, "b");
+    assertTokOther(lexer, ckalei::op_ge);
+    assertTokOther(lexer, ckalei::op_eq);
+    assertTokOther(lexer, ckalei::op_ne);
+    assertTokOther(lexer, ckalei::op_and);
+    assertTokOther(lexer, ckalei::op_or);
+    assertTokOther(lexer, '<');
+    assertTokOther(lexer, '=');
+    assertTokOther(lexer, '!');
+}
+
 TEST (lexer, var){
     auto data = R""""(
             var a = 1)"""";
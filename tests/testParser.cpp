@@ -422,3 +422,145 @@ TEST (parser, var_decl){
     std::cout << program.ppformat();
     ASSERT_EQ(program.ppformat(), expected);
 }
+
+TEST (parser, typed_declarations){
+    auto data = R""""(
+        def f(n:i64 x):f32 var y:f32 = tof32(x), z in y
+        def g(x:int) x
+                )"""";
+    auto expected =
+            R""""(Function(
+    Prototype(f(
+        n:i64
+        x
+    ):f32
+    DeclarationExpr(
+        y:f32
+            =
+            CallExpr(tof32(
+                VariableExpr(x)
+            )
+        z
+        VariableExpr(y)
+    )
+)
+)"""";
+    auto program = ckalei::Program(data);
+    ASSERT_EQ(program.ppformat(), expected);
+}
+
+/// Malformed inputs: each one used to hang or crash the parser or the code generator. Inputs found by the fuzzers
+/// of tests/fuzz go here.
+TEST (parser, malformed_inputs_terminate){
+    std::vector<std::string> inputs{
+        "foo(1 2",
+        "foo(",
+        "foo(1 2 ; 3 + 4",
+        "(1 + 2",
+        "def",
+        "extern",
+        "def binary",
+        "def binary : 1e300 (a b) a",
+        "def unary (a) a",
+        ")",
+        "var a = in 1",
+        "var a b in 1",
+        "for i 1, 2, 3 in 4",
+        "for i = 1 2, 3 in 4",
+        "if 1 then 2",
+        "if 1 else 2",
+        "x",
+        "1 % 2",
+        "-1",
+        "def f(x) x; def f(x) x;",
+        "extern f(a b) def f(a) a",
+        "def f(x) (var a = 1 in a) + x",
+        "\xff\xfe\x80 1 + \xff",
+        std::string(100000, '('),
+        std::string(100000, '-') + "1",
+        std::string(100000, '#') + "\n",
+    };
+    std::string comments;
+    for (int i=0; i<100000; i++){
+        comments += "# comment\n";
+    }
+    inputs.push_back(comments + "1");
+
+    for (const auto &input: inputs){
+        auto program = ckalei::Program(input);
+        auto pprint = program.ppformat();
+        auto assembly = program.getAssembly();
+    }
+}
+
+TEST (parser, builtin_operators){
+    auto defaults = ckalei::Parser(std::make_unique<ckalei::Lexer>("")).getPrecedences();
+    auto parser = ckalei::Parser(std::make_unique<ckalei::Lexer>(
+            "def binary > 50 (a b) a; def binary + 1 (a b) a; def binary == 5 (a b) a; 1 > 2"));
+    std::vector<std::string> names;
+    for (const auto &node: parser.getAstNodes()){
+        if (node){
+            names.push_back(dynamic_cast<ckalei::FunctionAST&>(*node).getProto()->getName());
+        }
+    }
+    // only the top level expression is kept, the precedences of the built in operators are unchanged
+    ASSERT_EQ(names, std::vector<std::string>{ckalei::ANONIMOUS_EXPR});
+    ASSERT_EQ(parser.getPrecedences(), defaults);
+}
+
+TEST (parser, error_recovery){
+    auto data = R""""(
+        def 1 foo;
+        3 + 4
+                )"""";
+    auto expected =
+            R""""(Function(
+    Prototype(__anon_expr(
+    )
+    BinaryExpr(
+        NumberExpr(3)
+        +
+        NumberExpr(4)
+    )
+)
+)"""";
+    auto program = ckalei::Program(data);
+    ASSERT_EQ(program.ppformat(), expected);
+}
+
+TEST (parser, nesting_limit){
+    auto nested = [](int depth){
+        return std::string(depth, '(') + "1" + std::string(depth, ')');
+    };
+    auto shallow = ckalei::Program(nested(ckalei::MAX_NESTING_DEPTH - 10));
+    ASSERT_NE(shallow.ppformat(), "");
+    auto deep = ckalei::Program(nested(ckalei::MAX_NESTING_DEPTH + 10));
+    ASSERT_EQ(deep.ppformat(), "");
+
+    // operator chains are built without recursion, their height is bounded too
+    auto chain = [](int operators){
+        std::string code = "1";
+        for (int i = 0; i < operators; i++){
+            code += "+1";
+        }
+        return code;
+    };
+    // the longest chain accepted is compiled without overflowing the stack
+    auto res = ckalei::Program(chain(ckalei::MAX_NESTING_DEPTH - 1)).evaluate();
+    ASSERT_EQ(*res, std::vector<double>({ckalei::MAX_NESTING_DEPTH}));
+    ASSERT_EQ(ckalei::Program(chain(ckalei::MAX_NESTING_DEPTH)).ppformat(), "");
+    ASSERT_EQ(ckalei::Program(chain(1000000)).ppformat(), "");
+    // an operand nested before the chain ends as deep as the chain is long
+    auto nestedChain = "(" + chain(ckalei::MAX_NESTING_DEPTH * 3 / 4) + ")" +
+                       chain(ckalei::MAX_NESTING_DEPTH / 2).substr(1);
+    ASSERT_EQ(ckalei::Program(nestedChain).ppformat(), "");
+
+    // sums of a few hundred variables are common in generated code
+    std::string args = "x0";
+    std::string sum = "x0";
+    for (int i = 1; i < 300; i++){
+        args += " x" + std::to_string(i);
+        sum += " + x" + std::to_string(i);
+    }
+    ASSERT_NE(ckalei::Program("def sum(" + args + ") " + sum).ppformat(), "");
+}
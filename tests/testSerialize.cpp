@@ -0,0 +1,168 @@
+//
+// Binary ast format: round trips, front end cache and rejection of malformed files
+//
+
+#include "gtest/gtest.h"
+#include "program.h"
+#include "serialize.h"
+
+/// Every node of the ast
+static const char *serializeCorpus = R""""(
+    extern cos(x)
+    def binary : 1 (x y) y;
+    def binary | 5 (a b)
+        if (a + b) then 1 else 0;
+    def unary - (v)
+        0 - v;
+    def noElse(x)
+        if x then 1;
+    def loop(n)
+        var total = 0, i in
+        (for i = 0, i < n, 1 in
+            total = total + cos(i)):
+        total;
+    def fib(x)
+        if (x < 3) then 1 else fib(x-1)+fib(x-2);
+    def between(x a b)
+        x >= a && x <= b || x == a - 1 != (x > b);
+    def scale(n:i64 x:f32):f32
+        var k:i64 = n * 2 in
+        if (for i:i64 = 0, i < k, 1 in 0) then x else tof32(k) * x;
+    fib(10) | -2.5
+    loop(4)
+)"""";
+
+/// Return the pretty print of nodes
+std::string ppformat(const std::vector<std::unique_ptr<ckalei::ASTNode>> &nodes)
+{
+    auto pprinter = ckalei::PPrintorVisitor();
+    for (const auto &node: nodes){
+        node->accept(pprinter);
+    }
+    return pprinter.getStr();
+}
+
+TEST (serialize, round_trip){
+    auto parser = ckalei::Parser(std::make_unique<ckalei::Lexer>(serializeCorpus));
+    auto nodes = parser.getAstNodes();
+    auto data = ckalei::ASTWriter().write(nodes, 42);
+
+    auto reader = ckalei::ASTReader(data);
+    std::vector<std::unique_ptr<ckalei::ASTNode>> readNodes;
+    ASSERT_TRUE(reader.read(readNodes));
+    ASSERT_EQ(reader.getSourceHash(), 42);
+    ASSERT_EQ(ppformat(nodes), ppformat(readNodes));
+
+    // precedence of binary operators is kept
+    auto *function = dynamic_cast<ckalei::FunctionAST*>(readNodes[2].get());
+    ASSERT_NE(function, nullptr);
+    ASSERT_TRUE(function->getProto()->isOperatorProto());
+    ASSERT_EQ(function->getProto()->getPrecedence(), 5);
+
+    // strings are interned and integers are varints: the format is smaller than the source
+    ASSERT_LT(data.size(), strlen(serializeCorpus) * 3 / 4);
+}
+
+TEST (serialize, evaluate_loaded){
+    auto program = ckalei::Program(serializeCorpus);
+    llvm::SmallString<128> path;
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testSerialize", "kast", path));
+    ASSERT_TRUE(program.saveAst(path.str().str()));
+
+    auto loaded = ckalei::Program::loadAst(path.str().str(), ckalei::sourceHash(serializeCorpus));
+    ASSERT_NE(loaded, nullptr);
+    ASSERT_EQ(*loaded->evaluate(), *program.evaluate());
+    ASSERT_EQ(ckalei::Program::loadAst(path.str().str(), 1), nullptr) << "the hash of another source must not match";
+    llvm::sys::fs::remove(path);
+}
+
+TEST (serialize, cache){
+    llvm::SmallString<128> directory;
+    ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("testSerialize", directory));
+    auto cacheDirectory = directory.str().str();
+
+    auto first = ckalei::Program::loadCached(serializeCorpus, cacheDirectory);
+    std::error_code error;
+    auto entries = llvm::sys::fs::directory_iterator(cacheDirectory, error);
+    ASSERT_NE(entries, llvm::sys::fs::directory_iterator()) << "the ast must be cached";
+    auto cachedPath = entries->path();
+
+    auto second = ckalei::Program::loadCached(serializeCorpus, cacheDirectory);
+    ASSERT_EQ(second->getStats().memory.sourceBytes, 0) << "the source must not be parsed again";
+    ASSERT_EQ(*first->evaluate(), *second->evaluate());
+
+    llvm::sys::fs::remove(cachedPath);
+    llvm::sys::fs::remove(cacheDirectory);
+}
+
+TEST (serialize, nesting_limit){
+    // the reader accepts the expressions the parser accepts, nothing deeper
+    auto chain = [](int operators){
+        std::unique_ptr<ckalei::ExprAST> expr = std::make_unique<ckalei::NumberExprAST>(1);
+        for (int i = 0; i < operators; i++){
+            expr = std::make_unique<ckalei::BinaryExprAST>(std::move(expr), std::make_unique<ckalei::NumberExprAST>(1),
+                                                           '+');
+        }
+        std::vector<std::unique_ptr<ckalei::ASTNode>> nodes;
+        nodes.push_back(std::make_unique<ckalei::FunctionAST>(
+                std::make_unique<ckalei::PrototypeAST>(ckalei::ANONIMOUS_EXPR, std::vector<std::string>()),
+                std::move(expr)));
+        return ckalei::ASTWriter().write(nodes, 0);
+    };
+    std::vector<std::unique_ptr<ckalei::ASTNode>> nodes;
+    ASSERT_TRUE(ckalei::ASTReader(chain(ckalei::MAX_NESTING_DEPTH - 1)).read(nodes));
+    ASSERT_FALSE(ckalei::ASTReader(chain(ckalei::MAX_NESTING_DEPTH)).read(nodes));
+}
+
+TEST (serialize, malformed_files){
+    auto parser = ckalei::Parser(std::make_unique<ckalei::Lexer>(serializeCorpus));
+    auto data = ckalei::ASTWriter().write(parser.getAstNodes(), 0);
+
+    std::vector<std::unique_ptr<ckalei::ASTNode>> nodes;
+    // every truncation is rejected
+    for (std::size_t size = 0; size < data.size(); size++){
+        ASSERT_FALSE(ckalei::ASTReader(llvm::StringRef(data.data(), size)).read(nodes)) << size;
+    }
+    // corrupted bytes are rejected or read as another valid ast, never trusted blindly
+    for (std::size_t i = 0; i < data.size(); i++){
+        auto corrupted = data;
+        corrupted[i] = (char) ~corrupted[i];
+        std::vector<std::unique_ptr<ckalei::ASTNode>> read;
+        if (ckalei::ASTReader(corrupted).read(read)){
+            auto assembly = ckalei::Program(std::move(read)).getAssembly();
+        }
+    }
+    // other versions are rejected
+    auto otherVersion = data;
+    otherVersion[4] = (char) (ckalei::AST_FORMAT_VERSION + 1);
+    ASSERT_FALSE(ckalei::ASTReader(otherVersion).read(nodes));
+}
+
+TEST (serialize, crafted_files){
+    auto function = [](ckalei::PrototypeAST proto, std::unique_ptr<ckalei::ExprAST> body){
+        std::vector<std::unique_ptr<ckalei::ASTNode>> nodes;
+        nodes.push_back(std::make_unique<ckalei::FunctionAST>(std::make_unique<ckalei::PrototypeAST>(proto),
+                                                              std::move(body)));
+        return ckalei::ASTWriter().write(nodes, 0);
+    };
+    auto one = [](){return std::make_unique<ckalei::NumberExprAST>(1);};
+    std::vector<std::unique_ptr<ckalei::ASTNode>> nodes;
+    ASSERT_TRUE(ckalei::ASTReader(function({"binary|", {"a", "b"}, true, 5}, one())).read(nodes));
+    ASSERT_TRUE(ckalei::ASTReader(function({"unary-", {"a"}, true}, one())).read(nodes));
+
+    // the prototypes the parser rejects
+    ASSERT_FALSE(ckalei::ASTReader(function({"binary|", {"a", "b", "c"}, true, 5}, one())).read(nodes));
+    ASSERT_FALSE(ckalei::ASTReader(function({"unary!", {}, true}, one())).read(nodes));
+    ASSERT_FALSE(ckalei::ASTReader(function({"binary|", {"a", "b"}, true, 0}, one())).read(nodes));
+    ASSERT_FALSE(ckalei::ASTReader(function({"binary|", {"a", "b"}, true, ckalei::MAX_PRECEDENCE + 1}, one()))
+                         .read(nodes));
+    ASSERT_FALSE(ckalei::ASTReader(function({"binary<", {"a", "b"}, true, 5}, one())).read(nodes));
+    ASSERT_FALSE(ckalei::ASTReader(function({"binary(", {"a", "b"}, true, 5}, one())).read(nodes));
+    ASSERT_FALSE(ckalei::ASTReader(function({"binary||", {"a", "b"}, true, 5}, one())).read(nodes));
+    ASSERT_FALSE(ckalei::ASTReader(function({"binary|", {"a", "b"}, false}, one())).read(nodes));
+    ASSERT_FALSE(ckalei::ASTReader(function({"toi64", {"x"}}, one())).read(nodes));
+    ASSERT_FALSE(ckalei::ASTReader(function({ckalei::ANONIMOUS_EXPR, {"x"}}, one())).read(nodes));
+    // and the unary operators it can not lex
+    auto unary = std::make_unique<ckalei::UnaryExprAST>('(', one());
+    ASSERT_FALSE(ckalei::ASTReader(function({ckalei::ANONIMOUS_EXPR, {}}, std::move(unary))).read(nodes));
+}
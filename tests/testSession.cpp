@@ -0,0 +1,228 @@
+//
+// Sessions and their snapshots
+//
+
+#include "gtest/gtest.h"
+#include "forkserver.h"
+#include "session.h"
+
+static const char *sessionLibrary = R""""(
+    extern cos(x)
+    def binary | 5 (a b) a + b;
+    def unary - (v) 0 - v;
+    def fib(x)
+        if (x < 3) then 1 else fib(x-1)+fib(x-2);
+    def wave(x) cos(x) | -1;
+    fib(5)
+)"""";
+
+TEST (session, definitions_persist){
+    auto session = ckalei::Session();
+    ASSERT_EQ(*session.evaluate(sessionLibrary), std::vector<double>{5});
+    ASSERT_EQ(*session.evaluate("fib(10)"), std::vector<double>{55});
+    // operators and their precedence persist too
+    ASSERT_EQ(*session.evaluate("1 | 2 * 3; -2"), (std::vector<double>{7, -2}));
+    ASSERT_EQ(session.getPrecedences().at('|'), 5);
+}
+
+TEST (session, snapshot){
+    llvm::SmallString<128> path;
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testSession", "snapshot", path));
+    {
+        auto session = ckalei::Session();
+        session.evaluate(sessionLibrary);
+        ASSERT_TRUE(session.saveSnapshot(path.str().str()));
+    }
+
+    auto restored = ckalei::Session::loadSnapshot(path.str().str());
+    ASSERT_NE(restored, nullptr);
+    ASSERT_EQ(*restored->evaluate("fib(10) wave(0) 1 | 2 * 3"), (std::vector<double>{55, 0, 7}));
+    ASSERT_EQ(*restored->evaluate("def twice(x) fib(x) * 2; twice(6)"), std::vector<double>{16});
+
+    // a snapshot of a restored session holds the restored code too
+    ASSERT_TRUE(restored->saveSnapshot(path.str().str()));
+    auto again = ckalei::Session::loadSnapshot(path.str().str());
+    ASSERT_NE(again, nullptr);
+    ASSERT_EQ(*again->evaluate("twice(6); -fib(3)"), (std::vector<double>{16, -2}));
+    llvm::sys::fs::remove(path);
+}
+
+TEST (session, snapshot_inline_operators){
+    llvm::SmallString<128> path;
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testSession", "snapshot", path));
+    {
+        auto session = ckalei::Session();
+        session.evaluate("def binary ~ 5 (x y) x - y; def f(x) x ~ 1;");
+        ASSERT_TRUE(session.saveSnapshot(path.str().str()));
+    }
+    // the restored functions which expanded an operator are compiled again when it is redefined
+    auto restored = ckalei::Session::loadSnapshot(path.str().str());
+    ASSERT_NE(restored, nullptr);
+    ASSERT_TRUE(restored->saveSnapshot(path.str().str()));
+    auto again = ckalei::Session::loadSnapshot(path.str().str());
+    ASSERT_NE(again, nullptr);
+    ASSERT_EQ(*again->evaluate("def binary ~ 5 (x y) x + y; f(5)"), std::vector<double>{6});
+    ASSERT_EQ(*restored->evaluate("f(5)"), std::vector<double>{4});
+
+    // the options apply to the code evaluated after the restore
+    ckalei::JitOptions options;
+    options.wholeProgram = true;
+    options.entryPoints = {"g"};
+    restored = ckalei::Session::loadSnapshot(path.str().str(), options);
+    ASSERT_NE(restored, nullptr);
+    ASSERT_EQ(*restored->evaluate("def h(x) f(x) * 2; def g(x) h(x); g(5)"), std::vector<double>{8});
+    ASSERT_TRUE(restored->evaluate("h(5)")->empty()) << "only the entry points stay callable";
+    llvm::sys::fs::remove(path);
+}
+
+TEST (session, incompatible_snapshots){
+    llvm::SmallString<128> path;
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testSession", "snapshot", path));
+    auto session = ckalei::Session();
+    session.evaluate(sessionLibrary);
+    ASSERT_TRUE(session.saveSnapshot(path.str().str()));
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    ASSERT_TRUE(buffer);
+    auto data = (*buffer)->getBuffer().str();
+
+    auto loadModified = [&](const std::string &modified){
+        std::error_code error;
+        {
+            llvm::raw_fd_ostream out(path, error);
+            out << modified;
+        }
+        return ckalei::Session::loadSnapshot(path.str().str());
+    };
+    auto otherVersion = data;
+    otherVersion[4] = (char) (ckalei::SNAPSHOT_FORMAT_VERSION + 1);
+    ASSERT_EQ(loadModified(otherVersion), nullptr);
+
+    auto otherLlvm = data;
+    otherLlvm[6] = '0'; // first digit of the llvm version
+    ASSERT_EQ(loadModified(otherLlvm), nullptr);
+
+    ASSERT_EQ(loadModified(data.substr(0, data.size() / 2)), nullptr);
+    ASSERT_NE(loadModified(data), nullptr);
+    llvm::sys::fs::remove(path);
+}
+
+TEST (session, shared_code){
+    llvm::SmallString<128> cache;
+    ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("testSessionCache", cache));
+    auto definitions = R""""(
+        extern sqrt(x)
+        def binary ^ 30 (a b) a * a + b * b;
+        def sharedNorm(x y) sqrt(x ^ y);
+    )"""";
+    auto listCache = [&](){
+        std::vector<std::string> files;
+        std::error_code error;
+        for (llvm::sys::fs::directory_iterator it(cache, error), end; it != end && !error; it.increment(error)){
+            files.push_back(it->path());
+        }
+        return files;
+    };
+
+    llvm::SmallString<128> path;
+    ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testSession", "snapshot", path));
+    {
+        auto session = ckalei::Session();
+        ASSERT_TRUE(session.loadSharedCode(definitions, cache.str().str()));
+        ASSERT_EQ(*session.evaluate("sharedNorm(3 4); 1 ^ 2"), (std::vector<double>{5, 5}));
+        // shared code calls the shared code loaded before it
+        ASSERT_TRUE(session.loadSharedCode("def sharedScaled(x y) 2 * sharedNorm(x y) + 0 ^ 1;", cache.str().str()));
+        ASSERT_EQ(*session.evaluate("sharedScaled(3 4)"), std::vector<double>{11});
+        ASSERT_TRUE(session.saveSnapshot(path.str().str()));
+    }
+    auto files = listCache();
+    ASSERT_EQ(files.size(), 2u);
+    for (const auto &file: files){
+        ASSERT_TRUE(llvm::StringRef(file).endswith(".so"));
+    }
+
+    // an other session maps the cached library instead of compiling it
+    auto lastModified = [&](){
+        std::vector<llvm::sys::TimePoint<>> times;
+        for (const auto &file: files){
+            llvm::sys::fs::file_status status;
+            EXPECT_FALSE(llvm::sys::fs::status(file, status));
+            times.push_back(status.getLastModificationTime());
+        }
+        return times;
+    };
+    auto modified = lastModified();
+    auto other = ckalei::Session();
+    ASSERT_TRUE(other.loadSharedCode(definitions, cache.str().str()));
+    ASSERT_EQ(*other.evaluate("def twiceNorm(x y) 2 * sharedNorm(x y); twiceNorm(6 8)"),
+              std::vector<double>{20});
+    ASSERT_EQ(lastModified(), modified);
+    ASSERT_EQ(listCache().size(), 2u);
+
+    // snapshots keep the shared code they use, wherever they are restored from
+    llvm::SmallString<128> cwd, tmp;
+    ASSERT_FALSE(llvm::sys::fs::current_path(cwd));
+    llvm::sys::path::system_temp_directory(true, tmp);
+    ASSERT_FALSE(llvm::sys::fs::set_current_path(tmp));
+    auto restored = ckalei::Session::loadSnapshot(path.str().str());
+    ASSERT_FALSE(llvm::sys::fs::set_current_path(cwd));
+    ASSERT_NE(restored, nullptr);
+    ASSERT_EQ(*restored->evaluate("sharedNorm(5 12); sharedScaled(6 8)"), (std::vector<double>{13, 21}));
+
+    ASSERT_FALSE(other.loadSharedCode("sharedNorm(1 1)", cache.str().str())) << "only definitions are shared";
+    llvm::sys::fs::remove(path);
+    for (const auto &file: listCache()){
+        llvm::sys::fs::remove(file);
+    }
+    llvm::sys::fs::remove(cache);
+}
+
+TEST (session, fork_server){
+    auto server = ckalei::ForkServer(sessionLibrary);
+    // the result of a worker is its exit code
+    auto evaluateIn = [](const std::string &code){
+        return [code](ckalei::Session &session){
+            auto res = session.evaluate(code);
+            return res->size() == 1 ? (int) res->front() : 255;
+        };
+    };
+    auto first = server.spawn(evaluateIn("fib(10)"));
+    auto second = server.spawn(evaluateIn("def local(x) x * 4 | 2; local(3)"));
+    ASSERT_GT(first, 0);
+    ASSERT_GT(second, 0);
+    ASSERT_EQ(ckalei::ForkServer::wait(first), 55);
+    ASSERT_EQ(ckalei::ForkServer::wait(second), 14);
+
+    // definitions of a worker stay in the worker
+    ASSERT_EQ(ckalei::ForkServer::wait(server.spawn(evaluateIn("local(1)"))), 255);
+    ASSERT_EQ(*server.getSession().evaluate("fib(6)"), std::vector<double>{8});
+}
+
+TEST (session, clone){
+    auto base = ckalei::Session();
+    base.evaluate(sessionLibrary);
+    {
+        auto request = base.clone();
+        ASSERT_EQ(*request->evaluate("fib(10) 1 | 2"), (std::vector<double>{55, 3}));
+        // a request redefines functions and operators for itself only
+        request->evaluate("def fib(x) x * 100; def binary | 5 (a b) a * b;");
+        ASSERT_EQ(*request->evaluate("fib(10) 2 | 3"), (std::vector<double>{1000, 6}));
+        ASSERT_EQ(*base.evaluate("fib(10) 2 | 3"), (std::vector<double>{55, 5}));
+
+        auto nested = request->clone();
+        nested->evaluate("def scaled(x) fib(x) + 1;");
+        ASSERT_EQ(*nested->evaluate("scaled(2)"), std::vector<double>{201});
+        request.reset(); // the nested clone keeps the layers below it alive
+        ASSERT_EQ(*nested->evaluate("scaled(3) wave(0)"), (std::vector<double>{301, 0}));
+
+        // a snapshot of a clone restores what the clone sees
+        llvm::SmallString<128> path;
+        ASSERT_FALSE(llvm::sys::fs::createTemporaryFile("testSession", "snapshot", path));
+        ASSERT_TRUE(nested->saveSnapshot(path.str().str()));
+        auto restored = ckalei::Session::loadSnapshot(path.str().str());
+        ASSERT_NE(restored, nullptr);
+        ASSERT_EQ(*restored->evaluate("scaled(1) fib(10) 2 | 3"), (std::vector<double>{101, 1000, 6}));
+        llvm::sys::fs::remove(path);
+    }
+    ASSERT_TRUE(base.evaluate("scaled(1)")->empty()) << "definitions of clones are freed with them";
+    ASSERT_EQ(*base.evaluate("fib(10)"), std::vector<double>{55});
+}